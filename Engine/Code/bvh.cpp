@@ -0,0 +1,383 @@
+//
+// bvh.cpp : Bounding volume hierarchy build (binned SAH), incremental refit with tree
+// rotations, and the frustum/sphere/ray queries used by culling, lights and picking.
+//
+
+#include "bvh.h"
+#include <float.h>
+#include <algorithm>
+
+#define BVH_SAH_BINS 12
+
+static f32 SurfaceArea(const AABB& aabb)
+{
+    glm::vec3 d = aabb.max - aabb.min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static i32 AllocateNode(BVH* bvh, i32 parent)
+{
+    BVHNode node;
+    node.aabb = EmptyAABB();
+    node.parent = parent;
+    node.left = BVH_NULL_NODE;
+    node.right = BVH_NULL_NODE;
+    node.item = BVH_NULL_NODE;
+    bvh->nodes.push_back(node);
+    return (i32)bvh->nodes.size() - 1;
+}
+
+static i32 BuildRecursive(BVH* bvh, const AABB* boxes, const glm::vec3* centroids, u32* items, u32 begin, u32 end, i32 parent)
+{
+    i32 nodeIdx = AllocateNode(bvh, parent);
+
+    AABB aabb = EmptyAABB();
+    AABB centroidBounds = EmptyAABB();
+    for (u32 i = begin; i < end; ++i)
+    {
+        aabb = MergeAABB(aabb, boxes[items[i]]);
+        centroidBounds.min = glm::min(centroidBounds.min, centroids[items[i]]);
+        centroidBounds.max = glm::max(centroidBounds.max, centroids[items[i]]);
+    }
+    bvh->nodes[nodeIdx].aabb = aabb;
+
+    if (end - begin == 1)
+    {
+        bvh->nodes[nodeIdx].item = (i32)items[begin];
+        bvh->itemToLeaf[items[begin]] = nodeIdx;
+        return nodeIdx;
+    }
+
+    // Split along the axis where the centroids are most spread
+    glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+    u32 axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    u32 mid = begin;
+    if (extent[axis] > 0.0f)
+    {
+        u32  binCount[BVH_SAH_BINS] = {};
+        AABB binBounds[BVH_SAH_BINS];
+        for (u32 b = 0; b < BVH_SAH_BINS; ++b)
+            binBounds[b] = EmptyAABB();
+
+        const f32 scale = (f32)BVH_SAH_BINS / extent[axis];
+        for (u32 i = begin; i < end; ++i)
+        {
+            u32 b = glm::min((u32)((centroids[items[i]][axis] - centroidBounds.min[axis]) * scale), (u32)BVH_SAH_BINS - 1);
+            binCount[b]++;
+            binBounds[b] = MergeAABB(binBounds[b], boxes[items[i]]);
+        }
+
+        // Sweep from the right to get the cost of every right side, then from the left
+        f32  rightArea[BVH_SAH_BINS];
+        u32  rightCount[BVH_SAH_BINS];
+        AABB acc = EmptyAABB();
+        u32  accCount = 0;
+        for (u32 b = BVH_SAH_BINS - 1; b > 0; --b)
+        {
+            acc = MergeAABB(acc, binBounds[b]);
+            accCount += binCount[b];
+            rightArea[b] = accCount ? SurfaceArea(acc) : 0.0f;
+            rightCount[b] = accCount;
+        }
+
+        f32 bestCost = FLT_MAX;
+        u32 bestSplit = 0;
+        acc = EmptyAABB();
+        accCount = 0;
+        for (u32 b = 0; b < BVH_SAH_BINS - 1; ++b)
+        {
+            acc = MergeAABB(acc, binBounds[b]);
+            accCount += binCount[b];
+            if (accCount == 0 || rightCount[b + 1] == 0)
+                continue;
+            f32 cost = accCount * SurfaceArea(acc) + rightCount[b + 1] * rightArea[b + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+
+        if (bestCost < FLT_MAX)
+        {
+            u32* it = std::partition(items + begin, items + end, [&](u32 item) {
+                u32 b = glm::min((u32)((centroids[item][axis] - centroidBounds.min[axis]) * scale), (u32)BVH_SAH_BINS - 1);
+                return b <= bestSplit;
+            });
+            mid = (u32)(it - items);
+        }
+    }
+
+    // All the centroids fell in the same place, just split in half
+    if (mid == begin || mid == end)
+    {
+        mid = (begin + end) / 2;
+        std::nth_element(items + begin, items + mid, items + end, [&](u32 a, u32 b) {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+    }
+
+    i32 left = BuildRecursive(bvh, boxes, centroids, items, begin, mid, nodeIdx);
+    i32 right = BuildRecursive(bvh, boxes, centroids, items, mid, end, nodeIdx);
+    bvh->nodes[nodeIdx].left = left;
+    bvh->nodes[nodeIdx].right = right;
+    return nodeIdx;
+}
+
+void BuildBVH(BVH* bvh, const AABB* boxes, u32 count)
+{
+    bvh->nodes.clear();
+    bvh->itemToLeaf.assign(count, BVH_NULL_NODE);
+    bvh->root = BVH_NULL_NODE;
+    if (count == 0)
+        return;
+
+    bvh->nodes.reserve(2 * count - 1);
+
+    std::vector<glm::vec3> centroids(count);
+    std::vector<u32> items(count);
+    for (u32 i = 0; i < count; ++i)
+    {
+        centroids[i] = 0.5f * (boxes[i].min + boxes[i].max);
+        items[i] = i;
+    }
+
+    bvh->root = BuildRecursive(bvh, boxes, centroids.data(), items.data(), 0, count, BVH_NULL_NODE);
+}
+
+static void RefitNode(BVH* bvh, i32 nodeIdx)
+{
+    BVHNode& node = bvh->nodes[nodeIdx];
+    node.aabb = MergeAABB(bvh->nodes[node.left].aabb, bvh->nodes[node.right].aabb);
+}
+
+// Swaps the subtree 'a' (child of nodeIdx) with the grandchild 'b' (child of 'sibling')
+static void SwapSubtrees(BVH* bvh, i32 nodeIdx, i32 a, i32 sibling, i32 b)
+{
+    BVHNode& node = bvh->nodes[nodeIdx];
+    BVHNode& sib = bvh->nodes[sibling];
+
+    if (node.left == a) node.left = b; else node.right = b;
+    if (sib.left == b)  sib.left = a;  else sib.right = a;
+
+    bvh->nodes[a].parent = sibling;
+    bvh->nodes[b].parent = nodeIdx;
+
+    RefitNode(bvh, sibling);
+}
+
+// Tree rotation (Kopta et al. 2012): try to exchange a child with one of its nephews
+// when that makes the modified child smaller.
+static void RotateNode(BVH* bvh, i32 nodeIdx)
+{
+    const BVHNode& node = bvh->nodes[nodeIdx];
+    const i32 children[2] = { node.left, node.right };
+
+    f32 bestGain = 0.0f;
+    i32 bestA = BVH_NULL_NODE, bestSibling = BVH_NULL_NODE, bestB = BVH_NULL_NODE;
+
+    for (u32 c = 0; c < 2; ++c)
+    {
+        i32 a = children[c];
+        i32 sibling = children[1 - c];
+        const BVHNode& sib = bvh->nodes[sibling];
+        if (sib.item != BVH_NULL_NODE)
+            continue;
+
+        f32 currentArea = SurfaceArea(sib.aabb);
+        const i32 nephews[2] = { sib.left, sib.right };
+        for (u32 n = 0; n < 2; ++n)
+        {
+            // After swapping 'a' with nephews[n], the sibling contains 'a' and the other nephew
+            AABB newSibling = MergeAABB(bvh->nodes[a].aabb, bvh->nodes[nephews[1 - n]].aabb);
+            f32 gain = currentArea - SurfaceArea(newSibling);
+            if (gain > bestGain)
+            {
+                bestGain = gain;
+                bestA = a;
+                bestSibling = sibling;
+                bestB = nephews[n];
+            }
+        }
+    }
+
+    if (bestA != BVH_NULL_NODE)
+        SwapSubtrees(bvh, nodeIdx, bestA, bestSibling, bestB);
+}
+
+void UpdateBVHItem(BVH* bvh, u32 item, const AABB& aabb)
+{
+    ASSERT(item < bvh->itemToLeaf.size(), "BVH item out of range");
+
+    i32 nodeIdx = bvh->itemToLeaf[item];
+    bvh->nodes[nodeIdx].aabb = aabb;
+
+    nodeIdx = bvh->nodes[nodeIdx].parent;
+    while (nodeIdx != BVH_NULL_NODE)
+    {
+        RefitNode(bvh, nodeIdx);
+        RotateNode(bvh, nodeIdx);
+        RefitNode(bvh, nodeIdx);
+        nodeIdx = bvh->nodes[nodeIdx].parent;
+    }
+}
+
+u32 GetBVHItemCount(const BVH& bvh)
+{
+    return (u32)bvh.itemToLeaf.size();
+}
+
+static void CollectLeaves(const BVH& bvh, i32 nodeIdx, std::vector<u32>* items)
+{
+    std::vector<i32> stack;
+    stack.push_back(nodeIdx);
+    while (!stack.empty())
+    {
+        const BVHNode& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+        if (node.item != BVH_NULL_NODE)
+        {
+            items->push_back((u32)node.item);
+        }
+        else
+        {
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+        }
+    }
+}
+
+void QueryBVHFrustum(const BVH& bvh, const Frustum& frustum, std::vector<u32>* items)
+{
+    if (bvh.root == BVH_NULL_NODE)
+        return;
+
+    // Each entry carries the mask of planes that still need to be tested: once a node
+    // is fully inside a plane its whole subtree is too.
+    struct Entry { i32 node; u32 planeMask; };
+    std::vector<Entry> stack;
+    stack.reserve(64);
+    stack.push_back({ bvh.root, 0x3F });
+
+    while (!stack.empty())
+    {
+        Entry entry = stack.back();
+        stack.pop_back();
+        const BVHNode& node = bvh.nodes[entry.node];
+
+        glm::vec3 center = 0.5f * (node.aabb.max + node.aabb.min);
+        glm::vec3 extent = 0.5f * (node.aabb.max - node.aabb.min);
+
+        bool outside = false;
+        u32 planeMask = entry.planeMask;
+        for (u32 p = 0; p < 6 && !outside; ++p)
+        {
+            if (!(planeMask & (1u << p)))
+                continue;
+            const glm::vec4& plane = frustum.planes[p];
+            f32 d = glm::dot(glm::vec3(plane), center) + plane.w;
+            f32 r = fabsf(plane.x) * extent.x + fabsf(plane.y) * extent.y + fabsf(plane.z) * extent.z;
+            if (d + r < 0.0f)
+                outside = true;
+            else if (d - r >= 0.0f)
+                planeMask &= ~(1u << p);
+        }
+
+        if (outside)
+            continue;
+
+        if (planeMask == 0)
+            CollectLeaves(bvh, entry.node, items);
+        else if (node.item != BVH_NULL_NODE)
+            items->push_back((u32)node.item);
+        else
+        {
+            stack.push_back({ node.left, planeMask });
+            stack.push_back({ node.right, planeMask });
+        }
+    }
+}
+
+void QueryBVHSphere(const BVH& bvh, const BoundingSphere& sphere, std::vector<u32>* items)
+{
+    if (bvh.root == BVH_NULL_NODE)
+        return;
+
+    f32 radiusSq = sphere.radius * sphere.radius;
+
+    std::vector<i32> stack;
+    stack.reserve(64);
+    stack.push_back(bvh.root);
+    while (!stack.empty())
+    {
+        const BVHNode& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+
+        glm::vec3 closest = glm::clamp(sphere.center, node.aabb.min, node.aabb.max);
+        glm::vec3 d = closest - sphere.center;
+        if (glm::dot(d, d) > radiusSq)
+            continue;
+
+        if (node.item != BVH_NULL_NODE)
+            items->push_back((u32)node.item);
+        else
+        {
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+        }
+    }
+}
+
+static bool RayAABB(const glm::vec3& origin, const glm::vec3& invDir, const AABB& aabb, f32 maxDistance, f32* tEnter)
+{
+    glm::vec3 t0 = (aabb.min - origin) * invDir;
+    glm::vec3 t1 = (aabb.max - origin) * invDir;
+    glm::vec3 tmin = glm::min(t0, t1);
+    glm::vec3 tmax = glm::max(t0, t1);
+    f32 enter = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+    f32 exit = glm::min(glm::min(tmax.x, tmax.y), glm::min(tmax.z, maxDistance));
+    *tEnter = enter;
+    return enter <= exit;
+}
+
+bool RaycastBVH(const BVH& bvh, const glm::vec3& origin, const glm::vec3& direction, f32 maxDistance, u32* item, f32* distance)
+{
+    if (bvh.root == BVH_NULL_NODE)
+        return false;
+
+    glm::vec3 invDir = 1.0f / direction;
+    f32 closest = maxDistance;
+    bool hit = false;
+
+    std::vector<i32> stack;
+    stack.reserve(64);
+    stack.push_back(bvh.root);
+    while (!stack.empty())
+    {
+        const BVHNode& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+
+        f32 t;
+        if (!RayAABB(origin, invDir, node.aabb, closest, &t))
+            continue;
+
+        if (node.item != BVH_NULL_NODE)
+        {
+            closest = t;
+            *item = (u32)node.item;
+            hit = true;
+        }
+        else
+        {
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+        }
+    }
+
+    if (hit)
+        *distance = closest;
+    return hit;
+}
@@ -0,0 +1,53 @@
+//
+// bvh.h: This file contains a bounding volume hierarchy over scene items (objects or lights).
+// It is built with the surface area heuristic and kept up to date incrementally when items
+// move, by refitting the path to the root and applying local tree rotations.
+//
+
+#pragma once
+
+#include "culling.h"
+
+#define BVH_NULL_NODE -1
+
+struct BVHNode
+{
+    AABB aabb;
+    i32  parent;
+    i32  left;
+    i32  right;
+    i32  item; // Index of the scene item for leaves, BVH_NULL_NODE for internal nodes
+};
+
+struct BVH
+{
+    std::vector<BVHNode> nodes;
+    std::vector<i32>     itemToLeaf;
+    i32                  root = BVH_NULL_NODE;
+};
+
+/**
+ * Builds the hierarchy from scratch with a binned SAH. Every leaf holds one item, item i
+ * being boxes[i]. Use this for static content or after big changes to the scene.
+ */
+void BuildBVH(BVH* bvh, const AABB* boxes, u32 count);
+
+/**
+ * Changes the bounds of one item and refits its ancestors, rotating the nodes on the way
+ * up whenever that reduces their surface area.
+ */
+void UpdateBVHItem(BVH* bvh, u32 item, const AABB& aabb);
+
+u32 GetBVHItemCount(const BVH& bvh);
+
+/** Appends to items every item whose bounds intersect the frustum. */
+void QueryBVHFrustum(const BVH& bvh, const Frustum& frustum, std::vector<u32>* items);
+
+/** Appends to items every item whose bounds intersect the sphere. */
+void QueryBVHSphere(const BVH& bvh, const BoundingSphere& sphere, std::vector<u32>* items);
+
+/**
+ * Finds the closest item whose bounds are hit by the ray (direction must be normalized).
+ * Returns false if nothing is hit before maxDistance.
+ */
+bool RaycastBVH(const BVH& bvh, const glm::vec3& origin, const glm::vec3& direction, f32 maxDistance, u32* item, f32* distance);
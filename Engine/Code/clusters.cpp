@@ -0,0 +1,227 @@
+//
+// clusters.cpp : Froxel grid bounds and the SIMD light assignment.
+//
+
+#include "clusters.h"
+#include "jobs.h"
+#include <float.h>
+#include <immintrin.h>
+
+void ClearClusterLights(ClusterLights* lights)
+{
+    lights->x.clear(); lights->y.clear(); lights->z.clear(); lights->radius.clear();
+    lights->dirX.clear(); lights->dirY.clear(); lights->dirZ.clear();
+    lights->cosAngle.clear(); lights->sinAngle.clear();
+    lights->index.clear();
+    lights->count = 0;
+    lights->global.clear();
+}
+
+void PushClusterLight(ClusterLights* lights, const glm::vec3& position, f32 radius, const glm::vec3& direction, f32 cosAngle, f32 sinAngle, u32 index)
+{
+    lights->x.push_back(position.x);
+    lights->y.push_back(position.y);
+    lights->z.push_back(position.z);
+    lights->radius.push_back(radius);
+    lights->dirX.push_back(direction.x);
+    lights->dirY.push_back(direction.y);
+    lights->dirZ.push_back(direction.z);
+    lights->cosAngle.push_back(cosAngle);
+    lights->sinAngle.push_back(sinAngle);
+    lights->index.push_back(index);
+}
+
+void AddClusterPointLight(ClusterLights* lights, const glm::vec3& viewPosition, f32 range, u32 index)
+{
+    // Without axis nor angle the cone test always passes
+    PushClusterLight(lights, viewPosition, range, glm::vec3(0.0f), -1.0f, 0.0f, index);
+    lights->count++;
+}
+
+void AddClusterSpotLight(ClusterLights* lights, const glm::vec3& viewPosition, const glm::vec3& direction, f32 outerAngle, f32 range, u32 index)
+{
+    PushClusterLight(lights, viewPosition, range, direction, cosf(outerAngle), sinf(outerAngle), index);
+    lights->count++;
+}
+
+glm::vec2 ClusterDepthScaleBias(f32 zNear, f32 zFar)
+{
+    // slice = log(depth / zNear) / log(zFar / zNear) * CLUSTER_Z
+    f32 scale = CLUSTER_Z / logf(zFar / zNear);
+    return glm::vec2(scale, -logf(zNear) * scale);
+}
+
+void UpdateClusterGrid(ClusterGrid* grid, const glm::mat4& projection, f32 zNear, f32 zFar)
+{
+    if (!grid->bounds.empty() && grid->projection == projection && grid->zNear == zNear && grid->zFar == zFar)
+        return;
+
+    grid->projection = projection;
+    grid->zNear = zNear;
+    grid->zFar = zFar;
+    grid->bounds.resize(CLUSTER_COUNT);
+
+    // Rays through the tile corners, scaled to the slice depths
+    glm::mat4 inverseProjection = glm::inverse(projection);
+    for (u32 z = 0; z < CLUSTER_Z; ++z)
+    {
+        f32 sliceNear = zNear * powf(zFar / zNear, (f32)z / CLUSTER_Z);
+        f32 sliceFar = zNear * powf(zFar / zNear, (f32)(z + 1) / CLUSTER_Z);
+        for (u32 y = 0; y < CLUSTER_Y; ++y)
+        {
+            for (u32 x = 0; x < CLUSTER_X; ++x)
+            {
+                AABB aabb = EmptyAABB();
+                for (u32 c = 0; c < 4; ++c)
+                {
+                    glm::vec2 ndc((f32)(x + (c & 1)) / CLUSTER_X * 2.0f - 1.0f, (f32)(y + (c >> 1)) / CLUSTER_Y * 2.0f - 1.0f);
+                    glm::vec4 farPoint = inverseProjection * glm::vec4(ndc, 1.0f, 1.0f);
+                    glm::vec3 ray = glm::vec3(farPoint) / farPoint.w;
+                    ray /= -ray.z;
+
+                    aabb.min = glm::min(aabb.min, glm::min(ray * sliceNear, ray * sliceFar));
+                    aabb.max = glm::max(aabb.max, glm::max(ray * sliceNear, ray * sliceFar));
+                }
+                grid->bounds[(z * CLUSTER_Y + y) * CLUSTER_X + x] = aabb;
+            }
+        }
+    }
+}
+
+void AssignSlice(void* data, u32 z)
+{
+    ClusterGrid* grid = (ClusterGrid*)data;
+    const ClusterLights& lights = *grid->lights;
+    u32 paddedCount = lights.x.size();
+
+    std::vector<u32>& list = grid->sliceIndices[z];
+    std::vector<u32>& offsetCount = grid->sliceOffsetCount[z];
+    offsetCount.resize(2 * CLUSTER_X * CLUSTER_Y);
+    u32 used = 0;
+
+    for (u32 c = 0; c < CLUSTER_X * CLUSTER_Y; ++c)
+    {
+        const AABB& aabb = grid->bounds[z * CLUSTER_X * CLUSTER_Y + c];
+        glm::vec3 center = 0.5f * (aabb.min + aabb.max);
+        f32 sphereRadius = glm::length(aabb.max - center);
+
+        // Room for every light, so the compaction below never checks the size
+        if (list.size() < used + paddedCount)
+            list.resize(used + paddedCount);
+        u32* out = list.data() + used;
+        u32 count = 0;
+        u32 i = 0;
+
+#if defined(__AVX__)
+        const __m256 minX = _mm256_set1_ps(aabb.min.x), minY = _mm256_set1_ps(aabb.min.y), minZ = _mm256_set1_ps(aabb.min.z);
+        const __m256 maxX = _mm256_set1_ps(aabb.max.x), maxY = _mm256_set1_ps(aabb.max.y), maxZ = _mm256_set1_ps(aabb.max.z);
+        const __m256 sX = _mm256_set1_ps(center.x), sY = _mm256_set1_ps(center.y), sZ = _mm256_set1_ps(center.z);
+        const __m256 sR = _mm256_set1_ps(sphereRadius);
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (; i + 8 <= paddedCount; i += 8)
+        {
+            __m256 lx = _mm256_loadu_ps(&lights.x[i]);
+            __m256 ly = _mm256_loadu_ps(&lights.y[i]);
+            __m256 lz = _mm256_loadu_ps(&lights.z[i]);
+            __m256 lr = _mm256_loadu_ps(&lights.radius[i]);
+
+            // Sphere vs AABB: squared distance from the center to the box
+            __m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minX, lx), _mm256_sub_ps(lx, maxX)), zero);
+            __m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minY, ly), _mm256_sub_ps(ly, maxY)), zero);
+            __m256 dz = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minZ, lz), _mm256_sub_ps(lz, maxZ)), zero);
+            __m256 distanceSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            __m256 inside = _mm256_cmp_ps(distanceSq, _mm256_mul_ps(lr, lr), _CMP_LE_OQ);
+
+            // Cone vs the cluster bounding sphere: behind the apex, past the range or outside the angle
+            __m256 vx = _mm256_sub_ps(sX, lx), vy = _mm256_sub_ps(sY, ly), vz = _mm256_sub_ps(sZ, lz);
+            __m256 vLengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+            __m256 v1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, _mm256_loadu_ps(&lights.dirX[i])), _mm256_mul_ps(vy, _mm256_loadu_ps(&lights.dirY[i]))),
+                                      _mm256_mul_ps(vz, _mm256_loadu_ps(&lights.dirZ[i])));
+            __m256 perpendicular = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(vLengthSq, _mm256_mul_ps(v1, v1)), zero));
+            __m256 closest = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(&lights.cosAngle[i]), perpendicular), _mm256_mul_ps(v1, _mm256_loadu_ps(&lights.sinAngle[i])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(closest, sR, _CMP_LE_OQ));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(v1, _mm256_add_ps(sR, lr), _CMP_LE_OQ));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(v1, _mm256_sub_ps(zero, sR), _CMP_GE_OQ));
+
+            u32 mask = (u32)_mm256_movemask_ps(inside);
+            for (u32 b = 0; b < 8; ++b)
+            {
+                out[count] = lights.index[i + b];
+                count += (mask >> b) & 1u;
+            }
+        }
+#endif
+
+        const __m128 minX4 = _mm_set1_ps(aabb.min.x), minY4 = _mm_set1_ps(aabb.min.y), minZ4 = _mm_set1_ps(aabb.min.z);
+        const __m128 maxX4 = _mm_set1_ps(aabb.max.x), maxY4 = _mm_set1_ps(aabb.max.y), maxZ4 = _mm_set1_ps(aabb.max.z);
+        const __m128 sX4 = _mm_set1_ps(center.x), sY4 = _mm_set1_ps(center.y), sZ4 = _mm_set1_ps(center.z);
+        const __m128 sR4 = _mm_set1_ps(sphereRadius);
+        const __m128 zero4 = _mm_setzero_ps();
+
+        for (; i + 4 <= paddedCount; i += 4)
+        {
+            __m128 lx = _mm_loadu_ps(&lights.x[i]);
+            __m128 ly = _mm_loadu_ps(&lights.y[i]);
+            __m128 lz = _mm_loadu_ps(&lights.z[i]);
+            __m128 lr = _mm_loadu_ps(&lights.radius[i]);
+
+            __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX4, lx), _mm_sub_ps(lx, maxX4)), zero4);
+            __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY4, ly), _mm_sub_ps(ly, maxY4)), zero4);
+            __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ4, lz), _mm_sub_ps(lz, maxZ4)), zero4);
+            __m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 inside = _mm_cmple_ps(distanceSq, _mm_mul_ps(lr, lr));
+
+            __m128 vx = _mm_sub_ps(sX4, lx), vy = _mm_sub_ps(sY4, ly), vz = _mm_sub_ps(sZ4, lz);
+            __m128 vLengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+            __m128 v1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(&lights.dirX[i])), _mm_mul_ps(vy, _mm_loadu_ps(&lights.dirY[i]))),
+                                   _mm_mul_ps(vz, _mm_loadu_ps(&lights.dirZ[i])));
+            __m128 perpendicular = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(vLengthSq, _mm_mul_ps(v1, v1)), zero4));
+            __m128 closest = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&lights.cosAngle[i]), perpendicular), _mm_mul_ps(v1, _mm_loadu_ps(&lights.sinAngle[i])));
+            inside = _mm_and_ps(inside, _mm_cmple_ps(closest, sR4));
+            inside = _mm_and_ps(inside, _mm_cmple_ps(v1, _mm_add_ps(sR4, lr)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(v1, _mm_sub_ps(zero4, sR4)));
+
+            u32 mask = (u32)_mm_movemask_ps(inside);
+            for (u32 b = 0; b < 4; ++b)
+            {
+                out[count] = lights.index[i + b];
+                count += (mask >> b) & 1u;
+            }
+        }
+
+        offsetCount[2 * c + 0] = used;
+        offsetCount[2 * c + 1] = count;
+        used += count;
+    }
+    list.resize(used);
+}
+
+void AssignLightsToClusters(ClusterGrid* grid, ClusterLights* lights)
+{
+    // Pad with lights too far away to touch anything, the loops have no scalar tail
+    while (lights->x.size() % 8 != 0)
+        PushClusterLight(lights, glm::vec3(1e18f), 0.0f, glm::vec3(0.0f), -1.0f, 0.0f, 0);
+
+    grid->lights = lights;
+    ParallelFor(CLUSTER_Z, AssignSlice, grid);
+    grid->lights = NULL;
+
+    // Concatenate the slices after the global lights
+    grid->indices.assign(lights->global.begin(), lights->global.end());
+    grid->offsetCount.resize(2 * CLUSTER_COUNT);
+    grid->maxClusterLights = 0;
+    for (u32 z = 0; z < CLUSTER_Z; ++z)
+    {
+        u32 base = grid->indices.size();
+        const std::vector<u32>& offsetCount = grid->sliceOffsetCount[z];
+        for (u32 c = 0; c < CLUSTER_X * CLUSTER_Y; ++c)
+        {
+            u32 cluster = z * CLUSTER_X * CLUSTER_Y + c;
+            grid->offsetCount[2 * cluster + 0] = base + offsetCount[2 * c + 0];
+            grid->offsetCount[2 * cluster + 1] = offsetCount[2 * c + 1];
+            grid->maxClusterLights = glm::max(grid->maxClusterLights, offsetCount[2 * c + 1]);
+        }
+        grid->indices.insert(grid->indices.end(), grid->sliceIndices[z].begin(), grid->sliceIndices[z].end());
+    }
+}
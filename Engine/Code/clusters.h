@@ -0,0 +1,67 @@
+//
+// clusters.h: This file contains the clustered light assignment: the view frustum is split
+// into a grid of froxels (screen tiles x logarithmic depth slices) and every froxel gets the
+// list of the lights whose volume touches it, so the light pass only iterates its own list.
+// The lights are tested 8 at a time (SIMD) and the depth slices are spread across the job
+// threads. Doesn't touch OpenGL at all.
+//
+
+#pragma once
+
+#include "culling.h"
+
+// Must match the CLUSTER_ values in LightPassShader.glsl
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+// View space light volumes, structure of arrays padded to a multiple of 8 lights
+struct ClusterLights
+{
+    std::vector<f32> x, y, z, radius;    // Sphere around the light position
+    std::vector<f32> dirX, dirY, dirZ;   // Spot axis, 0 for point lights
+    std::vector<f32> cosAngle, sinAngle; // Spot outer angle, (-1, 0) for point lights
+    std::vector<u32> index;              // Written to the cluster lists
+    u32 count = 0;
+
+    // Lights touching every cluster (directional), first in the index list
+    std::vector<u32> global;
+};
+
+struct ClusterGrid
+{
+    // View space bounds of every cluster, x fastest, then y, then the depth slice
+    std::vector<AABB> bounds;
+    glm::mat4 projection;
+    f32 zNear = 0.0f, zFar = 0.0f;
+
+    // Per cluster (offset, count) into indices, which starts with the global lights
+    std::vector<u32> offsetCount;
+    std::vector<u32> indices;
+    u32 maxClusterLights = 0;
+
+    // Filled in parallel, one list per depth slice
+    std::vector<u32> sliceIndices[CLUSTER_Z];
+    std::vector<u32> sliceOffsetCount[CLUSTER_Z];
+    const ClusterLights* lights = NULL;
+};
+
+void ClearClusterLights(ClusterLights* lights);
+
+void AddClusterPointLight(ClusterLights* lights, const glm::vec3& viewPosition, f32 range, u32 index);
+
+/** outerAngle is the half angle of the cone in radians, direction a unit view space vector. */
+void AddClusterSpotLight(ClusterLights* lights, const glm::vec3& viewPosition, const glm::vec3& direction, f32 outerAngle, f32 range, u32 index);
+
+/** Slice of a view depth (distance in front of the eye): log(depth) * scale + bias. */
+glm::vec2 ClusterDepthScaleBias(f32 zNear, f32 zFar);
+
+/** Recomputes the cluster bounds when the projection or the depth range changed. */
+void UpdateClusterGrid(ClusterGrid* grid, const glm::mat4& projection, f32 zNear, f32 zFar);
+
+/**
+ * Builds the light list of every cluster: sphere vs AABB for every light, plus a cone vs
+ * the cluster bounding sphere test for the spots. One job per depth slice.
+ */
+void AssignLightsToClusters(ClusterGrid* grid, ClusterLights* lights);
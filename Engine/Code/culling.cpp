@@ -0,0 +1,254 @@
+//
+// culling.cpp : Bounding volume helpers and frustum culling. The batch test works on the
+// structure of arrays in BoundsSoA and compacts the visible indices without branches.
+//
+
+#include "culling.h"
+#include <float.h>
+#include <immintrin.h>
+
+AABB EmptyAABB()
+{
+    AABB aabb;
+    aabb.min = glm::vec3( FLT_MAX);
+    aabb.max = glm::vec3(-FLT_MAX);
+    return aabb;
+}
+
+AABB MergeAABB(const AABB& a, const AABB& b)
+{
+    AABB res;
+    res.min = glm::min(a.min, b.min);
+    res.max = glm::max(a.max, b.max);
+    return res;
+}
+
+AABB TransformAABB(const AABB& aabb, const glm::mat4& transform)
+{
+    glm::vec3 center = 0.5f * (aabb.max + aabb.min);
+    glm::vec3 extent = 0.5f * (aabb.max - aabb.min);
+
+    glm::vec3 newCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+    glm::vec3 newExtent;
+    for (u32 i = 0; i < 3; ++i)
+        newExtent[i] = fabsf(transform[0][i]) * extent.x + fabsf(transform[1][i]) * extent.y + fabsf(transform[2][i]) * extent.z;
+
+    AABB res;
+    res.min = newCenter - newExtent;
+    res.max = newCenter + newExtent;
+    return res;
+}
+
+BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& transform)
+{
+    f32 sx = glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0]));
+    f32 sy = glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1]));
+    f32 sz = glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]));
+
+    BoundingSphere res;
+    res.center = glm::vec3(transform * glm::vec4(sphere.center, 1.0f));
+    res.radius = sphere.radius * sqrtf(glm::max(sx, glm::max(sy, sz)));
+    return res;
+}
+
+void ComputeBounds(const f32* vertices, u32 vertexCount, u32 stride, AABB* aabb, BoundingSphere* sphere)
+{
+    *aabb = EmptyAABB();
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        glm::vec3 p = glm::vec3(vertices[i * stride + 0], vertices[i * stride + 1], vertices[i * stride + 2]);
+        aabb->min = glm::min(aabb->min, p);
+        aabb->max = glm::max(aabb->max, p);
+    }
+
+    if (vertexCount == 0)
+    {
+        aabb->min = aabb->max = glm::vec3(0.0f);
+        sphere->center = glm::vec3(0.0f);
+        sphere->radius = 0.0f;
+        return;
+    }
+
+    // Centered on the box, with the radius reaching the farthest vertex
+    sphere->center = 0.5f * (aabb->min + aabb->max);
+    f32 radiusSq = 0.0f;
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        glm::vec3 p = glm::vec3(vertices[i * stride + 0], vertices[i * stride + 1], vertices[i * stride + 2]);
+        glm::vec3 d = p - sphere->center;
+        radiusSq = glm::max(radiusSq, glm::dot(d, d));
+    }
+    sphere->radius = sqrtf(radiusSq);
+}
+
+Frustum ExtractFrustum(const glm::mat4& m)
+{
+    // Gribb/Hartmann: combine the rows of the view projection matrix (glm is column major)
+    glm::vec4 row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row3 + row2;
+    frustum.planes[5] = row3 - row2;
+
+    for (u32 i = 0; i < 6; ++i)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+
+    return frustum;
+}
+
+bool AABBInFrustum(const Frustum& frustum, const AABB& aabb)
+{
+    glm::vec3 center = 0.5f * (aabb.max + aabb.min);
+    glm::vec3 extent = 0.5f * (aabb.max - aabb.min);
+
+    for (u32 i = 0; i < 6; ++i)
+    {
+        const glm::vec4& p = frustum.planes[i];
+        f32 d = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+        f32 r = fabsf(p.x) * extent.x + fabsf(p.y) * extent.y + fabsf(p.z) * extent.z;
+        if (d + r < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+bool SphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere)
+{
+    for (u32 i = 0; i < 6; ++i)
+    {
+        const glm::vec4& p = frustum.planes[i];
+        if (glm::dot(glm::vec3(p), sphere.center) + p.w < -sphere.radius)
+            return false;
+    }
+    return true;
+}
+
+void ResizeBounds(BoundsSoA* bounds, u32 count)
+{
+    // Padded to a multiple of 8 so the SIMD loop never reads past the end
+    u32 padded = (count + 7u) & ~7u;
+    bounds->centerX.resize(padded); bounds->centerY.resize(padded); bounds->centerZ.resize(padded);
+    bounds->extentX.resize(padded); bounds->extentY.resize(padded); bounds->extentZ.resize(padded);
+    bounds->count = count;
+}
+
+void SetBounds(BoundsSoA* bounds, u32 index, const AABB& aabb)
+{
+    bounds->centerX[index] = 0.5f * (aabb.max.x + aabb.min.x);
+    bounds->centerY[index] = 0.5f * (aabb.max.y + aabb.min.y);
+    bounds->centerZ[index] = 0.5f * (aabb.max.z + aabb.min.z);
+    bounds->extentX[index] = 0.5f * (aabb.max.x - aabb.min.x);
+    bounds->extentY[index] = 0.5f * (aabb.max.y - aabb.min.y);
+    bounds->extentZ[index] = 0.5f * (aabb.max.z - aabb.min.z);
+}
+
+u32 CullBounds(const Frustum& frustum, const BoundsSoA& bounds, u32* visibleIndices)
+{
+    const u32 count = bounds.count;
+    u32 visibleCount = 0;
+    u32 i = 0;
+
+#if defined(__AVX__)
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+    __m256 absX[6], absY[6], absZ[6];
+    for (u32 p = 0; p < 6; ++p)
+    {
+        planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+        absX[p] = _mm256_set1_ps(fabsf(frustum.planes[p].x));
+        absY[p] = _mm256_set1_ps(fabsf(frustum.planes[p].y));
+        absZ[p] = _mm256_set1_ps(fabsf(frustum.planes[p].z));
+    }
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (u32 p = 0; p < 6; ++p)
+        {
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], cx), _mm256_mul_ps(planeY[p], cy)),
+                                     _mm256_add_ps(_mm256_mul_ps(planeZ[p], cz), planeW[p]));
+            __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absX[p], ex), _mm256_mul_ps(absY[p], ey)),
+                                     _mm256_mul_ps(absZ[p], ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+        }
+
+        u32 mask = (u32)_mm256_movemask_ps(inside);
+        for (u32 b = 0; b < 8; ++b)
+        {
+            visibleIndices[visibleCount] = i + b;
+            visibleCount += (mask >> b) & 1u;
+        }
+    }
+#endif
+
+    __m128 planeX4[6], planeY4[6], planeZ4[6], planeW4[6];
+    __m128 absX4[6], absY4[6], absZ4[6];
+    for (u32 p = 0; p < 6; ++p)
+    {
+        planeX4[p] = _mm_set1_ps(frustum.planes[p].x);
+        planeY4[p] = _mm_set1_ps(frustum.planes[p].y);
+        planeZ4[p] = _mm_set1_ps(frustum.planes[p].z);
+        planeW4[p] = _mm_set1_ps(frustum.planes[p].w);
+        absX4[p] = _mm_set1_ps(fabsf(frustum.planes[p].x));
+        absY4[p] = _mm_set1_ps(fabsf(frustum.planes[p].y));
+        absZ4[p] = _mm_set1_ps(fabsf(frustum.planes[p].z));
+    }
+    const __m128 zero4 = _mm_setzero_ps();
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+        __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+        __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (u32 p = 0; p < 6; ++p)
+        {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX4[p], cx), _mm_mul_ps(planeY4[p], cy)),
+                                  _mm_add_ps(_mm_mul_ps(planeZ4[p], cz), planeW4[p]));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX4[p], ex), _mm_mul_ps(absY4[p], ey)),
+                                  _mm_mul_ps(absZ4[p], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero4));
+        }
+
+        u32 mask = (u32)_mm_movemask_ps(inside);
+        for (u32 b = 0; b < 4; ++b)
+        {
+            visibleIndices[visibleCount] = i + b;
+            visibleCount += (mask >> b) & 1u;
+        }
+    }
+
+    for (; i < count; ++i)
+    {
+        AABB aabb;
+        glm::vec3 c = glm::vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        glm::vec3 e = glm::vec3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+        aabb.min = c - e;
+        aabb.max = c + e;
+        visibleIndices[visibleCount] = i;
+        visibleCount += AABBInFrustum(frustum, aabb) ? 1u : 0u;
+    }
+
+    return visibleCount;
+}
@@ -0,0 +1,67 @@
+//
+// culling.h: This file contains the bounding volume types and the visibility tests used
+// to discard scene objects that the camera can't see before submitting them.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct AABB
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere
+{
+    glm::vec3 center;
+    f32       radius;
+};
+
+// Planes are stored as (normal, distance) with the normals pointing inside the frustum.
+// Order: left, right, bottom, top, near, far.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+// World space object bounds stored as structure of arrays (center + half extents)
+// so several objects can be tested against a plane with a single SIMD instruction.
+struct BoundsSoA
+{
+    std::vector<f32> centerX, centerY, centerZ;
+    std::vector<f32> extentX, extentY, extentZ;
+    u32 count = 0;
+};
+
+AABB EmptyAABB();
+
+AABB MergeAABB(const AABB& a, const AABB& b);
+
+AABB TransformAABB(const AABB& aabb, const glm::mat4& transform);
+
+BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& transform);
+
+/**
+ * Computes the AABB and the bounding sphere of a vertex stream. Positions are the first three
+ * floats of every vertex, stride is the vertex size in floats.
+ */
+void ComputeBounds(const f32* vertices, u32 vertexCount, u32 stride, AABB* aabb, BoundingSphere* sphere);
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+bool AABBInFrustum(const Frustum& frustum, const AABB& aabb);
+
+bool SphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere);
+
+void ResizeBounds(BoundsSoA* bounds, u32 count);
+
+void SetBounds(BoundsSoA* bounds, u32 index, const AABB& aabb);
+
+/**
+ * Tests all the boxes in bounds against the frustum and writes the indices of the visible
+ * ones into visibleIndices (which must have room for bounds.count entries).
+ * Processes 8 boxes per iteration with AVX, 4 with SSE otherwise. Returns the visible count.
+ */
+u32 CullBounds(const Frustum& frustum, const BoundsSoA& bounds, u32* visibleIndices);
@@ -54,8 +54,8 @@ GLuint CreateTexture2DFromImage(Image image)
     glGenTextures(1, &texHandle);
     glBindTexture(GL_TEXTURE_2D, texHandle);
     glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -65,6 +65,18 @@ GLuint CreateTexture2DFromImage(Image image)
     return texHandle;
 }
 
+/** Index 0 is the white placeholder texture created by Init, failed loads are UINT32_MAX. */
+bool HasTexture(const App* app, u32 texIdx)
+{
+    return texIdx > 0 && texIdx < app->textures.size();
+}
+
+/** GL handle of a texture index, the white placeholder if the index doesn't name a loaded texture. */
+GLuint TextureHandle(const App* app, u32 texIdx)
+{
+    return app->textures[HasTexture(app, texIdx) ? texIdx : 0].handle;
+}
+
 u32 LoadTexture2D(App* app, const char* filepath)
 {
     for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
@@ -172,6 +184,7 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 bas
     // add the submesh into the mesh
     Submesh submesh = {};
     submesh.vertexBufferLayout = vertexBufferLayout;
+    ComputeBounds(vertices.data(), mesh->mNumVertices, vertexBufferLayout.stride / sizeof(float), &submesh.aabb, &submesh.sphere);
     submesh.vertices.swap(vertices);
     submesh.indices.swap(indices);
     myMesh->submeshes.push_back(submesh);
@@ -251,6 +264,70 @@ void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 bas
     }
 }
 
+void SetupMeshVertexArray(const Mesh& mesh, GLuint vao)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+
+    if (mesh.submeshes.size() > 0)
+    {
+        for (u32 i = 0; i < mesh.submeshes[0].vertexBufferLayout.attributes.size(); ++i) {
+
+            glEnableVertexAttribArray(mesh.submeshes[0].vertexBufferLayout.attributes[i].id);
+            glVertexAttribPointer(mesh.submeshes[0].vertexBufferLayout.attributes[i].id, mesh.submeshes[0].vertexBufferLayout.attributes[i].quantity, GL_FLOAT, GL_FALSE, mesh.submeshes[0].vertexBufferLayout.stride, reinterpret_cast<void*>(mesh.submeshes[0].vertexBufferLayout.attributes[i].stride));
+        }
+    }
+
+    // The element buffer binding is part of the vertex array state, unbind the vertex array first
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/** Only the position attribute, read from the packed position buffer. */
+void SetupMeshPositionArray(const Mesh& mesh, GLuint vao)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.positionBufferHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)0);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BindDrawIDAttribute(GLuint vao, GLuint drawIDBuffer)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+    glEnableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+    glVertexAttribIPointer(DRAW_ID_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+    glVertexAttribDivisor(DRAW_ID_ATTRIBUTE, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BindInstanceAttributes(GLuint vao, GLuint instanceBuffer)
+{
+    // InstanceData: model matrix, one vec4 column per attribute, then the material index
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (u32 c = 0; c < 4; ++c)
+    {
+        glEnableVertexAttribArray(INSTANCE_MODEL_ATTRIBUTE + c);
+        glVertexAttribPointer(INSTANCE_MODEL_ATTRIBUTE + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(c * sizeof(vec4)));
+        glVertexAttribDivisor(INSTANCE_MODEL_ATTRIBUTE + c, 1);
+    }
+    glEnableVertexAttribArray(INSTANCE_MATERIAL_ATTRIBUTE);
+    glVertexAttribIPointer(INSTANCE_MATERIAL_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)offsetof(InstanceData, materialIdx));
+    glVertexAttribDivisor(INSTANCE_MATERIAL_ATTRIBUTE, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 u32 LoadModel(App* app, const char* filename)
 {
     const aiScene* scene = aiImportFile(filename,
@@ -293,6 +370,18 @@ u32 LoadModel(App* app, const char* filename)
 
     aiReleaseImport(scene);
 
+    mesh.aabb = EmptyAABB();
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        mesh.aabb = MergeAABB(mesh.aabb, mesh.submeshes[i].aabb);
+
+    mesh.sphere.center = mesh.submeshes.empty() ? vec3(0.0f) : 0.5f * (mesh.aabb.min + mesh.aabb.max);
+    mesh.sphere.radius = 0.0f;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const BoundingSphere& sub = mesh.submeshes[i].sphere;
+        mesh.sphere.radius = glm::max(mesh.sphere.radius, glm::length(sub.center - mesh.sphere.center) + sub.radius);
+    }
+
     u32 vertexBufferSize = 0;
     u32 indexBufferSize = 0;
 
@@ -302,9 +391,6 @@ u32 LoadModel(App* app, const char* filename)
         indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
     }
 
-    glGenVertexArrays(1, &mesh.vertexArrayHandle);
-    glBindVertexArray(mesh.vertexArrayHandle);
-
     glGenBuffers(1, &mesh.vertexBufferHandle);
     glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
     glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
@@ -331,23 +417,52 @@ u32 LoadModel(App* app, const char* filename)
         indicesOffset += indicesSize;
     }
 
-    if (mesh.submeshes.size() > 0)
-    {
-        for (u32 i = 0; i < mesh.submeshes[0].vertexBufferLayout.attributes.size(); ++i) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-            glEnableVertexAttribArray(mesh.submeshes[0].vertexBufferLayout.attributes[i].id);
-            glVertexAttribPointer(mesh.submeshes[0].vertexBufferLayout.attributes[i].id, mesh.submeshes[0].vertexBufferLayout.attributes[i].quantity, GL_FLOAT, GL_FALSE, mesh.submeshes[0].vertexBufferLayout.stride, reinterpret_cast<void*>(mesh.submeshes[0].vertexBufferLayout.attributes[i].stride));
-        }
+    // Positions alone for the depth pre-pass, same vertex order so the draw commands are shared.
+    // The draws assume every submesh has the layout of the first one (see SetupMeshVertexArray).
+    std::vector<vec3> positions;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        u32 strideFloats = submesh.vertexBufferLayout.stride / sizeof(f32);
+        u32 positionOffset = 0;
+        for (u32 a = 0; a < submesh.vertexBufferLayout.attributes.size(); ++a)
+            if (submesh.vertexBufferLayout.attributes[a].id == 0)
+                positionOffset = submesh.vertexBufferLayout.attributes[a].stride / sizeof(f32);
+
+        for (u32 v = 0; v + strideFloats <= submesh.vertices.size(); v += strideFloats)
+            positions.push_back(vec3(submesh.vertices[v + positionOffset], submesh.vertices[v + positionOffset + 1], submesh.vertices[v + positionOffset + 2]));
     }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glGenBuffers(1, &mesh.positionBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.positionBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(vec3), positions.data(), GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+
+    // Instanced draws read the transforms from the instance stream
+    glGenVertexArrays(1, &mesh.vertexArrayHandle);
+    SetupMeshVertexArray(mesh, mesh.vertexArrayHandle);
+    BindInstanceAttributes(mesh.vertexArrayHandle, app->uniformRing.buffer);
+
+    // GPU generated draws read the draw record index (one instance, baseInstance = record index)
+    glGenVertexArrays(1, &mesh.indirectVertexArrayHandle);
+    SetupMeshVertexArray(mesh, mesh.indirectVertexArrayHandle);
+    BindDrawIDAttribute(mesh.indirectVertexArrayHandle, app->gpuScene.drawIDs);
+
+    glGenVertexArrays(1, &mesh.depthVertexArrayHandle);
+    SetupMeshPositionArray(mesh, mesh.depthVertexArrayHandle);
+    BindInstanceAttributes(mesh.depthVertexArrayHandle, app->uniformRing.buffer);
+
+    glGenVertexArrays(1, &mesh.depthIndirectVertexArrayHandle);
+    SetupMeshPositionArray(mesh, mesh.depthIndirectVertexArrayHandle);
+    BindDrawIDAttribute(mesh.depthIndirectVertexArrayHandle, app->gpuScene.drawIDs);
 
     return modelIdx;
 }
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, const char* defines = "")
 {
     GLchar  infoLogBuffer[1024] = {};
     GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
@@ -363,24 +478,28 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     const GLchar* vertexShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         vertexShaderDefine,
         programSource.str
     };
     const GLint vertexShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(vertexShaderDefine),
         (GLint) programSource.len
     };
     const GLchar* fragmentShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         fragmentShaderDefine,
         programSource.str
     };
     const GLint fragmentShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(fragmentShaderDefine),
         (GLint) programSource.len
     };
@@ -426,233 +545,2801 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+u32 HashString(const char* str)
 {
-    String programSource = ReadTextFile(filepath);
-
-    Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
-    program.filepath = filepath;
-    program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
-    app->programs.push_back(program);
-
-    return app->programs.size() - 1;
+    // FNV-1a
+    u32 hash = 2166136261u;
+    for (; *str; ++str)
+        hash = (hash ^ (u8)*str) * 16777619u;
+    return hash;
 }
 
-void Init(App* app)
+void AddProgramResource(Program* program, ProgramResourceTable* table, const char* name, GLint value)
 {
-    // TODO: Initialize your resources here!
-    // - vertex buffers
-    // - element/index buffers
-    // - vaos
-    // - programs (and retrieve uniform indices)
-    // - textures
-
-    //Deferred FBO Setup
-    u32 width = app->deferredFBO.width = app->displaySize.x;
-    u32 height =  app->deferredFBO.height = app->displaySize.y;
-    glGenFramebuffers(1, &app->deferredFBO.ID);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->deferredFBO.ID);
-
-    // position
-    unsigned int tex = 0;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
-    app->deferredFBO.texturesID.push_back(tex);
-
-    // normal
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, tex, 0);
-    app->deferredFBO.texturesID.push_back(tex);
-
-    // Albedo
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, tex, 0);
-    app->deferredFBO.texturesID.push_back(tex);
-
-    // Specular + Shininess + Alpha
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, tex, 0);
-    app->deferredFBO.texturesID.push_back(tex);
-
-    // Result
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, GL_TEXTURE_2D, tex, 0);
-    app->deferredFBO.texturesID.push_back(tex);
-
-    // Bind Attachments
-    unsigned int attachments[5] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4 };
-    glDrawBuffers(5, attachments);
+    u32 hash = HashString(name);
+    auto it = table->find(hash);
+    if (it != table->end() && it->second != value)
+        ELOG("Program %s: resource %s collides with another name, rename one of them", program->programName.c_str(), name);
+    (*table)[hash] = value;
+}
 
+bool IsSamplerType(GLint type)
+{
+    switch (type)
+    {
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_MULTISAMPLE:
+        case GL_SAMPLER_BUFFER: case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+            return true;
+        default:
+            return false;
+    }
+}
 
-    glGenTextures(1, &app->deferredFBO.depthBufferTexture);
-    glBindTexture(GL_TEXTURE_2D, app->deferredFBO.depthBufferTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, app->deferredFBO.depthBufferTexture, 0);
+void ReflectProgram(Program* program)
+{
+    program->uniforms.clear();
+    program->samplers.clear();
+    program->uniformBlocks.clear();
+    program->storageBlocks.clear();
+
+    GLuint handle = program->handle;
+    GLchar name[256];
+    GLint  count = 0;
+
+    glGetProgramInterfaceiv(handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+    GLint samplerUnit = 0;
+    for (GLint i = 0; i < count; ++i)
+    {
+        const GLenum props[] = { GL_LOCATION, GL_TYPE, GL_BLOCK_INDEX };
+        GLint values[ARRAY_COUNT(props)];
+        glGetProgramResourceiv(handle, GL_UNIFORM, i, ARRAY_COUNT(props), props, ARRAY_COUNT(values), NULL, values);
+        if (values[2] != -1)
+            continue; // Member of a uniform block, it has no location
+
+        glGetProgramResourceName(handle, GL_UNIFORM, i, sizeof(name), NULL, name);
+        GLint location = values[0];
+
+        // Arrays are reported as "name[0]", make them reachable as "name" too
+        char* arraySuffix = strstr(name, "[0]");
+        if (arraySuffix && arraySuffix[3] == '\0')
+        {
+            AddProgramResource(program, &program->uniforms, name, location);
+            *arraySuffix = '\0';
+        }
+        AddProgramResource(program, &program->uniforms, name, location);
 
-    glGenRenderbuffers(1, &app->deferredFBO.depthBuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, app->deferredFBO.depthBuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, app->deferredFBO.depthBuffer);
+        if (IsSamplerType(values[1]))
+        {
+            glProgramUniform1i(handle, location, samplerUnit);
+            AddProgramResource(program, &program->samplers, name, samplerUnit);
+            samplerUnit++;
+        }
+    }
 
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGetProgramInterfaceiv(handle, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        glGetProgramResourceName(handle, GL_UNIFORM_BLOCK, i, sizeof(name), NULL, name);
+        AddProgramResource(program, &program->uniformBlocks, name, i);
+    }
 
-    //Light Sphere
-    u32 lats = 40, longs = 40;
-    int i, j;
-    std::vector<GLfloat> vertices;
-    std::vector<GLuint> indices;
-    int indicator = 0;
-    for (i = 0; i <= lats; i++) {
-        double lat0 = glm::pi<double>() * (-0.5 + (double)(i - 1) / lats);
-        double z0 = sin(lat0);
-        double zr0 = cos(lat0);
+    glGetProgramInterfaceiv(handle, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        glGetProgramResourceName(handle, GL_SHADER_STORAGE_BLOCK, i, sizeof(name), NULL, name);
+        AddProgramResource(program, &program->storageBlocks, name, i);
+    }
+}
 
-        double lat1 = glm::pi<double>() * (-0.5 + (double)i / lats);
-        double z1 = sin(lat1);
-        double zr1 = cos(lat1);
+GLint GetUniformLocation(const Program& program, const char* name)
+{
+    auto it = program.uniforms.find(HashString(name));
+    return it != program.uniforms.end() ? it->second : -1;
+}
 
-        for (j = 0; j <= longs; j++) {
-            double lng = 2 * glm::pi<double>() * (double)(j - 1) / longs;
-            double x = cos(lng);
-            double y = sin(lng);
+GLint GetSamplerUnit(const Program& program, const char* name)
+{
+    auto it = program.samplers.find(HashString(name));
+    return it != program.samplers.end() ? it->second : 0;
+}
 
-            vertices.push_back(x * zr0);
-            vertices.push_back(y * zr0);
-            vertices.push_back(z0);
-            indices.push_back(indicator);
-            indicator++;
+/** defines are extra "#define X\n" lines, so the same file can be loaded as several variants. */
+u32 LoadProgram(App* app, const char* filepath, const char* programName, const char* defines = "")
+{
+    String programSource = ReadTextFile(filepath);
 
-            vertices.push_back(x * zr1);
-            vertices.push_back(y * zr1);
-            vertices.push_back(z1);
-            indices.push_back(indicator);
-            indicator++;
-        }
-        indices.push_back(GL_PRIMITIVE_RESTART_FIXED_INDEX);
-    }
+    Program program = {};
+    program.handle = CreateProgramFromSource(programSource, programName, defines);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.defines = defines;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.isCompute = false;
+    ReflectProgram(&program);
+    app->programs.push_back(program);
 
-    glGenVertexArrays(1, &app->Svao);
-    glBindVertexArray(app->Svao);
+    return app->programs.size() - 1;
+}
 
-    glGenBuffers(1, &app->Svbo);
-    glBindBuffer(GL_ARRAY_BUFFER, app->Svbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName, const char* defines = "")
+{
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(0);
+    char versionString[] = "#version 430\n";
+    char shaderNameDefine[128];
+    sprintf(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
 
-    glGenBuffers(1, &app->Sebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->Sebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        defines,
+        computeShaderDefine,
+        programSource.str
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint) strlen(versionString),
+        (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
+        (GLint) strlen(computeShaderDefine),
+        (GLint) programSource.len
+    };
 
-    app->Stri = indices.size();
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+    glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
 
-    //Quad buffer
-    float quadVertices[] = {
-        // positions        // texture Coords
-        -1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
-        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
-         1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
-         1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-    };
-    // setup plane
-    glGenVertexArrays(1, &app->vao);
-    glGenBuffers(1, &app->vbo);
-    glBindVertexArray(app->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, app->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+    GLuint programHandle = glCreateProgram();
+    glAttachShader(programHandle, cshader);
+    glLinkProgram(programHandle);
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
 
-    app->mode = Mode_TexturedQuad;
+    glDetachShader(programHandle, cshader);
+    glDeleteShader(cshader);
 
+    return programHandle;
+}
 
-    app->cam.cameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
-    app->cam.cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
-    app->cam.cameraDirection = glm::normalize(app->cam.cameraPos - app->cam.cameraTarget);
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName, const char* defines = "")
+{
+    String programSource = ReadTextFile(filepath);
 
+    Program program = {};
+    program.handle = CreateComputeProgramFromSource(programSource, programName, defines);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.defines = defines;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.isCompute = true;
+    ReflectProgram(&program);
+    app->programs.push_back(program);
 
-    vec3 up = vec3(0.0f, 1.0f, 0.0f);
-    app->cam.cameraRight = glm::normalize(glm::cross(up, app->cam.cameraDirection));
-    app->cam.cameraFront = vec3(0.0f, 0.0f, -1.0f);
-    app->cam.cameraUp = vec3(0.0f, 1.0f, 0.0f);
+    return app->programs.size() - 1;
+}
 
-    u32 mLoaded = LoadModel(app, "Patrick\\Patrick.obj");
+void ReloadModifiedPrograms(App* app)
+{
+    for (u32 i = 0; i < app->programs.size(); ++i)
+    {
+        Program& program = app->programs[i];
+        u64 timestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+        if (timestamp <= program.lastWriteTimestamp)
+            continue;
+        program.lastWriteTimestamp = timestamp;
+
+        String programSource = ReadTextFile(program.filepath.c_str());
+        GLuint handle = program.isCompute ? CreateComputeProgramFromSource(programSource, program.programName.c_str(), program.defines.c_str())
+                                          : CreateProgramFromSource(programSource, program.programName.c_str(), program.defines.c_str());
+        GLint success;
+        glGetProgramiv(handle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // Keep running with the previous version until the file is fixed
+            glDeleteProgram(handle);
+            continue;
+        }
 
-    glm::mat4 trans = glm::mat4(1.0f);
-    trans = glm::translate(trans, vec3(0.0));
+        glDeleteProgram(program.handle);
+        program.handle = handle;
+        ReflectProgram(&program);
+        ILOG("Program %s reloaded", program.programName.c_str());
+    }
+}
 
-    app->modelSceneObjects.push_back(ModelSceneObject());
-    ModelSceneObject& sobj = app->modelSceneObjects.back();
+AABB ObjectWorldBounds(App* app, u32 objectIdx)
+{
+    const ModelSceneObject& sobj = app->modelSceneObjects[objectIdx];
+    const Mesh& mesh = app->meshes[app->models[sobj.modelIdx].meshIdx];
+    return TransformAABB(mesh.aabb, sobj.transform);
+}
 
-    sobj.modelIdx = mLoaded;
-    sobj.transform = trans;
+f32 LightRange(const Light& light, f32 threshold)
+{
+    // Distance where intensity * brightest channel / (c + l*d + q*d^2) falls under the threshold
+    f32 brightness = light.intensity * glm::max(glm::max(light.diffuse.r, light.diffuse.g), glm::max(light.diffuse.b, light.specular));
+    f32 c = light.constant - brightness / threshold;
+    if (c >= 0.0f)
+        return 0.0f; // Never reaches the threshold
+    if (light.quadratic > 0.0f)
+        return (-light.linear + sqrtf(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+    if (light.linear > 0.0f)
+        return -c / light.linear;
+    return 1000.0f;
+}
 
-    app->lightSceneObjects.push_back(LightSceneObject());
-    LightSceneObject& lsObj = app->lightSceneObjects.back();
-    lsObj.position = vec3(0.0f, 5.0f, 0.0f);
-    lsObj.direction = vec3(0.0f, -1.0f, 0.0f);
-    lsObj.light.type = L_POINT;
-    lsObj.light.intensity = 1.0f;
-    lsObj.light.constant = 1.0f;
-    lsObj.light.linear = 1.0f;
-    lsObj.light.quadratic = 1.0f;
-    lsObj.light.diffuse = vec3(0.8f);
-    lsObj.light.specular = 0.2f;
-    lsObj.light.cutOff[0] = 12.5f;
-    lsObj.light.outerCutOff[0] = 17.5f;
-    lsObj.light.cutOff[1] = glm::cos(glm::radians(lsObj.light.cutOff[0]));
-    lsObj.light.outerCutOff[1] = glm::cos(glm::radians(lsObj.light.outerCutOff[0]));
+BoundingSphere LightBoundingSphere(const LightSceneObject& lsObj, f32 threshold)
+{
+    f32 range = LightRange(lsObj.light, threshold);
 
-    app->programGeoPass = LoadProgram(app, "GeoPassShader.glsl", "GEOMETRY_PASS");
-    app->programLightPass = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS");
-    app->programquadReder = LoadProgram(app, "QuadRender.glsl", "QUAD_RENDER");
+    BoundingSphere sphere;
+    sphere.center = lsObj.position;
+    sphere.radius = range;
 
+    f32 directionLength = glm::length(lsObj.direction);
+    if (lsObj.light.type == L_SPOTLIGHT && directionLength > 0.0f)
+    {
+        // Smallest sphere around the cone of the outer angle: wide cones are bounded by their
+        // cap, narrow ones by the sphere through the apex and the cap rim
+        vec3 axis = lsObj.direction / directionLength;
+        f32 angle = glm::radians(glm::clamp(lsObj.light.outerCutOff[0], 0.0f, 90.0f));
+        f32 cosAngle = cosf(angle);
+        if (angle > 0.25f * PI)
+        {
+            sphere.center = lsObj.position + axis * (range * cosAngle);
+            sphere.radius = range * sinf(angle);
+        }
+        else
+        {
+            sphere.radius = range / (2.0f * cosAngle);
+            sphere.center = lsObj.position + axis * sphere.radius;
+        }
+    }
+    return sphere;
 }
 
-void Gui(App* app)
+AABB SphereAABB(const BoundingSphere& sphere)
 {
-    ImGui::Begin("Info");
-    ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
-    ImGui::Combo("Select Texture", &app->textureOutputType, "Position\0Normal\0Albedo\0Final\0Depth\0");
-    ImGui::TextWrapped("Everything works correctly but the final render do not display anything");
-    ImGui::End();
+    AABB aabb;
+    aabb.min = sphere.center - vec3(sphere.radius);
+    aabb.max = sphere.center + vec3(sphere.radius);
+    return aabb;
 }
 
-void Update(App* app)
+void SetObjectTransform(App* app, u32 objectIdx, const glm::mat4& transform)
 {
-    // You can handle app->input keyboard/mouse here
+    app->modelSceneObjects[objectIdx].transform = transform;
+    app->dirtyObjects.push_back(objectIdx);
 }
 
-void Render(App* app)
+void SetLightPosition(App* app, u32 lightIdx, vec3 position)
+{
+    app->lightSceneObjects[lightIdx].position = position;
+    app->dirtyLights.push_back(lightIdx);
+}
+
+void UpdateSceneBVHs(App* app)
+{
+    u32 objectCount = app->modelSceneObjects.size();
+    u32 lightCount = app->lightSceneObjects.size();
+
+    if (app->sceneBVHDirty || GetBVHItemCount(app->objectBVH) != objectCount || app->lightToBVHItem.size() != lightCount)
+    {
+        // Full SAH build
+        app->objectWorldBounds.resize(objectCount);
+        for (u32 i = 0; i < objectCount; ++i)
+            app->objectWorldBounds[i] = ObjectWorldBounds(app, i);
+        BuildBVH(&app->objectBVH, app->objectWorldBounds.data(), objectCount);
+
+        // Directional lights affect everything so they stay out of the hierarchy
+        std::vector<AABB> lightBounds;
+        app->lightBVHItems.clear();
+        app->lightToBVHItem.assign(lightCount, -1);
+        for (u32 i = 0; i < lightCount; ++i)
+        {
+            if (app->lightSceneObjects[i].light.type == L_DIRECTIONAL)
+                continue;
+            app->lightToBVHItem[i] = (i32)app->lightBVHItems.size();
+            app->lightBVHItems.push_back(i);
+            lightBounds.push_back(SphereAABB(LightBoundingSphere(app->lightSceneObjects[i], app->lightCutoff)));
+        }
+        BuildBVH(&app->lightBVH, lightBounds.data(), lightBounds.size());
+
+        app->sceneBVHDirty = false;
+        app->gpuScene.dirty = true;
+    }
+    else
+    {
+        // Incremental refit of the items that moved since last frame
+        for (u32 i = 0; i < app->dirtyObjects.size(); ++i)
+        {
+            u32 objectIdx = app->dirtyObjects[i];
+            app->objectWorldBounds[objectIdx] = ObjectWorldBounds(app, objectIdx);
+            UpdateBVHItem(&app->objectBVH, objectIdx, app->objectWorldBounds[objectIdx]);
+            app->gpuScene.dirty = true;
+        }
+        for (u32 i = 0; i < app->dirtyLights.size(); ++i)
+        {
+            u32 lightIdx = app->dirtyLights[i];
+            if (app->lightToBVHItem[lightIdx] >= 0)
+                UpdateBVHItem(&app->lightBVH, app->lightToBVHItem[lightIdx], SphereAABB(LightBoundingSphere(app->lightSceneObjects[lightIdx], app->lightCutoff)));
+        }
+    }
+
+    app->dirtyObjects.clear();
+    app->dirtyLights.clear();
+}
+
+#define OCCLUSION_TEST_BATCH 256
+
+void OcclusionTestBatch(void* data, u32 batchIdx)
+{
+    App* app = (App*)data;
+    u32 begin = batchIdx * OCCLUSION_TEST_BATCH;
+    u32 end = glm::min(begin + OCCLUSION_TEST_BATCH, (u32)app->visibleObjects.size());
+    for (u32 v = begin; v < end; ++v)
+    {
+        u32 objectIdx = app->visibleObjects[v];
+        app->occlusionVisibility[v] = app->modelSceneObjects[objectIdx].isOccluder ||
+                                      IsAABBVisible(app->occlusionBuffer, app->objectWorldBounds[objectIdx]);
+    }
+}
+
+u32 OcclusionCullObjects(App* app)
+{
+    // Rasterize the occluders that survived the frustum test
+    ClearOcclusionBuffer(&app->occlusionBuffer, app->cam.projection * app->cam.view);
+    for (u32 v = 0; v < app->visibleObjects.size(); ++v)
+    {
+        const ModelSceneObject& sobj = app->modelSceneObjects[app->visibleObjects[v]];
+        if (!sobj.isOccluder)
+            continue;
+
+        const Mesh& mesh = app->meshes[app->models[sobj.modelIdx].meshIdx];
+        for (u32 s = 0; s < mesh.submeshes.size(); ++s)
+        {
+            const Submesh& submesh = mesh.submeshes[s];
+            AddOccluder(&app->occlusionBuffer, sobj.transform, submesh.vertices.data(), submesh.vertexBufferLayout.stride / sizeof(float),
+                        submesh.indices.data(), submesh.indices.size());
+        }
+        app->stats.occluders++;
+    }
+    RasterizeOccluders(&app->occlusionBuffer);
+
+    // Test the rest of the visible objects against the hierarchical depth and compact the list
+    u32 visibleCount = app->visibleObjects.size();
+    app->occlusionVisibility.resize(visibleCount);
+    ParallelFor((visibleCount + OCCLUSION_TEST_BATCH - 1) / OCCLUSION_TEST_BATCH, OcclusionTestBatch, app);
+
+    u32 count = 0;
+    for (u32 v = 0; v < visibleCount; ++v)
+        if (app->occlusionVisibility[v])
+            app->visibleObjects[count++] = app->visibleObjects[v];
+
+    app->visibleObjects.resize(count);
+    app->stats.objectsOccluded = visibleCount - count;
+    return count;
+}
+
+u32 CullObjects(App* app, const Frustum& frustum)
+{
+    u32 objectCount = app->modelSceneObjects.size();
+    app->visibleObjects.resize(objectCount);
+    app->stats = {};
+
+    u32 visibleCount = objectCount;
+    if (app->frustumCulling && app->useBVH)
+    {
+        app->visibleObjects.clear();
+        QueryBVHFrustum(app->objectBVH, frustum, &app->visibleObjects);
+        visibleCount = app->visibleObjects.size();
+    }
+    else if (app->frustumCulling)
+    {
+        ResizeBounds(&app->objectBounds, objectCount);
+        for (u32 i = 0; i < objectCount; ++i)
+            SetBounds(&app->objectBounds, i, ObjectWorldBounds(app, i));
+        visibleCount = CullBounds(frustum, app->objectBounds, app->visibleObjects.data());
+    }
+    else
+    {
+        for (u32 i = 0; i < objectCount; ++i)
+            app->visibleObjects[i] = i;
+    }
+
+    app->visibleObjects.resize(visibleCount);
+    app->stats.objectsCulled = objectCount - visibleCount;
+
+    if (app->occlusionCulling)
+        visibleCount = OcclusionCullObjects(app);
+
+    app->stats.objectsDrawn = visibleCount;
+    return visibleCount;
+}
+
+/** True if both materials bind the same textures, so their draws can share a multi-draw call. */
+bool SameMaterialTextures(const App* app, u32 a, u32 b)
+{
+    const Material& ma = app->materials[a];
+    const Material& mb = app->materials[b];
+    if (!HasTexture(app, ma.albedoTextureIdx) && !HasTexture(app, mb.albedoTextureIdx))
+        return true;
+    return TextureHandle(app, ma.albedoTextureIdx) == TextureHandle(app, mb.albedoTextureIdx) &&
+           TextureHandle(app, ma.specularTextureIdx) == TextureHandle(app, mb.specularTextureIdx);
+}
+
+u32 SubmeshMaterialIdx(const App* app, const Model& model, u32 submeshIdx)
+{
+    return submeshIdx < model.materialIdx.size() ? model.materialIdx[submeshIdx] : app->defaultMaterialIdx;
+}
+
+/** Geometry and light pass programs of the current G-buffer layout. */
+u32 GeoPassProgramIdx(const App* app)
+{
+    return app->compactGBuffer ? app->geoPassCompactProgramIdx : app->geoPassProgramIdx;
+}
+
+u32 LightPassProgramIdx(const App* app)
+{
+    if (app->lightingMode == LightingMode_Clustered)
+        return app->compactGBuffer ? app->lightPassClusteredCompactProgramIdx : app->lightPassClusteredProgramIdx;
+    if (!app->perTypeLightLoops)
+        return app->compactGBuffer ? app->lightPassMixedCompactProgramIdx : app->lightPassMixedProgramIdx;
+    return app->compactGBuffer ? app->lightPassCompactProgramIdx : app->lightPassProgramIdx;
+}
+
+u32 TiledLightingProgramIdx(const App* app)
+{
+    return app->compactGBuffer ? app->tiledLightingCompactProgramIdx : app->tiledLightingProgramIdx;
+}
+
+/** Emits a packet per visible (object, submesh) and sorts them. Returns the packet count. */
+u32 BuildRenderQueue(App* app, const Frustum& frustum)
+{
+    RenderQueue& queue = app->renderQueue;
+    ClearRenderQueue(&queue);
+
+    const Camera& cam = app->cam;
+    f32 depthScale = 1.0f / (cam.zFar - cam.zNear);
+
+    for (u32 v = 0; v < app->visibleObjects.size(); ++v)
+    {
+        u32 objectIdx = app->visibleObjects[v];
+        const ModelSceneObject& sobj = app->modelSceneObjects[objectIdx];
+        const Model& model = app->models[sobj.modelIdx];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+
+        for (u32 s = 0; s < mesh.submeshes.size(); ++s)
+        {
+            BoundingSphere sphere = TransformSphere(mesh.submeshes[s].sphere, sobj.transform);
+
+            // Single submesh objects were already tested with the object bounds
+            if (app->frustumCulling && mesh.submeshes.size() > 1 && !SphereInFrustum(frustum, sphere))
+            {
+                app->stats.submeshesCulled++;
+                continue;
+            }
+
+            f32 viewDepth = -(cam.view * vec4(sphere.center, 1.0f)).z;
+            u64 key = MakeSortKey(RenderPass_Geometry, GeoPassProgramIdx(app), SubmeshMaterialIdx(app, model, s), model.meshIdx, s,
+                                  (viewDepth - cam.zNear) * depthScale);
+            PushRenderPacket(&queue, key, objectIdx, s);
+        }
+    }
+
+    SortRenderQueue(&queue);
+    return queue.packets.size();
+}
+
+/**
+ * Walks the sorted render queue: packets with the same state key become the instances of one
+ * indirect command (front to back), baseInstance relative to the start of app->instanceData.
+ * The queue is ordered by material first, consecutive commands that use the same vertex array
+ * and textures are grouped to be drawn with one call, so the state only changes at key boundaries.
+ */
+void BuildIndirectDraws(App* app)
+{
+    app->instanceData.clear();
+    app->indirectCommands.clear();
+    app->indirectGroups.clear();
+
+    const std::vector<RenderPacket>& packets = app->renderQueue.packets;
+    u64 stateKey = ~0ull;
+    for (u32 p = 0; p < packets.size(); ++p)
+    {
+        const RenderPacket& packet = packets[p];
+        const ModelSceneObject& sobj = app->modelSceneObjects[packet.objectIdx];
+        const Model& model = app->models[sobj.modelIdx];
+        u32 materialIdx = SubmeshMaterialIdx(app, model, packet.submeshIdx);
+
+        InstanceData instance = {};
+        instance.model = sobj.transform;
+        instance.materialIdx = materialIdx;
+        app->instanceData.push_back(instance);
+
+        if ((packet.key & SORT_KEY_STATE_MASK) == stateKey)
+        {
+            app->indirectCommands.back().instanceCount++;
+            continue;
+        }
+        stateKey = packet.key & SORT_KEY_STATE_MASK;
+
+        const Submesh& submesh = app->meshes[model.meshIdx].submeshes[packet.submeshIdx];
+        DrawElementsIndirectCommand command = {};
+        command.count = submesh.indices.size();
+        command.instanceCount = 1;
+        command.firstIndex = submesh.indexOffset / sizeof(u32);
+        command.baseVertex = submesh.vertexOffset / submesh.vertexBufferLayout.stride;
+        command.baseInstance = app->instanceData.size() - 1;
+
+        IndirectGroup* group = app->indirectGroups.empty() ? NULL : &app->indirectGroups.back();
+        if (!group || group->meshIdx != model.meshIdx || !SameMaterialTextures(app, group->materialIdx, materialIdx))
+        {
+            IndirectGroup newGroup = {};
+            newGroup.meshIdx = model.meshIdx;
+            newGroup.materialIdx = materialIdx;
+            newGroup.firstCommand = app->indirectCommands.size();
+            app->indirectGroups.push_back(newGroup);
+            group = &app->indirectGroups.back();
+        }
+        group->commandCount++;
+        app->indirectCommands.push_back(command);
+    }
+}
+
+void CullLights(App* app, const Frustum& frustum)
+{
+    u32 lightCount = app->lightSceneObjects.size();
+    app->visibleLights.clear();
+
+    // Directional lights reach every pixel
+    for (u32 i = 0; i < lightCount; ++i)
+        if (app->lightSceneObjects[i].light.type == L_DIRECTIONAL)
+            app->visibleLights.push_back(i);
+
+    if (!app->lightCulling)
+    {
+        for (u32 i = 0; i < lightCount; ++i)
+            if (app->lightSceneObjects[i].light.type != L_DIRECTIONAL)
+                app->visibleLights.push_back(i);
+    }
+    else if (app->useBVH)
+    {
+        // The hierarchy stores the boxes around the spheres, test the spheres themselves afterwards
+        app->lightQueryItems.clear();
+        QueryBVHFrustum(app->lightBVH, frustum, &app->lightQueryItems);
+        for (u32 i = 0; i < app->lightQueryItems.size(); ++i)
+        {
+            u32 lightIdx = app->lightBVHItems[app->lightQueryItems[i]];
+            if (SphereInFrustum(frustum, LightBoundingSphere(app->lightSceneObjects[lightIdx], app->lightCutoff)))
+                app->visibleLights.push_back(lightIdx);
+        }
+    }
+    else
+    {
+        for (u32 i = 0; i < lightCount; ++i)
+        {
+            const LightSceneObject& lsObj = app->lightSceneObjects[i];
+            if (lsObj.light.type != L_DIRECTIONAL && SphereInFrustum(frustum, LightBoundingSphere(lsObj, app->lightCutoff)))
+                app->visibleLights.push_back(i);
+        }
+    }
+
+    app->stats.lightsVisible = app->visibleLights.size();
+    app->stats.lightsCulled = lightCount - app->stats.lightsVisible;
+}
+
+u32 UploadLights(App* app)
+{
+    // Stable counting sort by type, keeps the ranges in LightType order
+    u32 typeCounts[3] = {};
+    for (u32 v = 0; v < app->visibleLights.size(); ++v)
+        typeCounts[app->lightSceneObjects[app->visibleLights[v]].light.type]++;
+    u32 typeOffsets[3] = { 0, typeCounts[L_DIRECTIONAL], typeCounts[L_DIRECTIONAL] + typeCounts[L_POINT] };
+    app->firstPointLight = typeOffsets[L_POINT];
+    app->firstSpotLight = typeOffsets[L_SPOTLIGHT];
+
+    app->lightSortScratch.resize(app->visibleLights.size());
+    for (u32 v = 0; v < app->visibleLights.size(); ++v)
+        app->lightSortScratch[typeOffsets[app->lightSceneObjects[app->visibleLights[v]].light.type]++] = app->visibleLights[v];
+    app->visibleLights.swap(app->lightSortScratch);
+
+    app->gpuLights.resize(app->visibleLights.size());
+    for (u32 v = 0; v < app->visibleLights.size(); ++v)
+    {
+        const LightSceneObject& lsObj = app->lightSceneObjects[app->visibleLights[v]];
+        const Light& light = lsObj.light;
+        GPULight& gpuLight = app->gpuLights[v];
+
+        gpuLight.positionType = vec4(light.type == L_DIRECTIONAL ? vec3(0.0f) : lsObj.position, f32(light.type));
+        gpuLight.directionIntensity = vec4(lsObj.direction, light.intensity);
+        gpuLight.diffuseSpecular = vec4(light.diffuse, light.specular);
+        gpuLight.clq = vec4(light.constant, light.linear, light.quadratic, LightRange(light, app->lightCutoff));
+        gpuLight.co = vec4(light.cutOff[1], light.outerCutOff[1], 0.0f, 0.0f);
+    }
+
+    // Grow (with some slack) instead of reallocating every time the visible count changes
+    u32 count = app->gpuLights.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->lightBuffer);
+    if (count > app->lightBufferCapacity)
+    {
+        app->lightBufferCapacity = glm::max(count + count / 2, 64u);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, app->lightBufferCapacity * sizeof(GPULight), NULL, GL_DYNAMIC_DRAW);
+    }
+    if (count > 0)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(GPULight), app->gpuLights.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return count;
+}
+
+/** Assigns the uploaded lights to the froxels of the camera and uploads the cluster lists. */
+void BuildLightClusters(App* app)
+{
+    ClusterLights& clusterLights = app->clusterLights;
+    ClearClusterLights(&clusterLights);
+
+    // Lights in view space, indexed like gpuLights
+    for (u32 v = 0; v < app->visibleLights.size(); ++v)
+    {
+        const LightSceneObject& lsObj = app->lightSceneObjects[app->visibleLights[v]];
+        const Light& light = lsObj.light;
+        if (light.type == L_DIRECTIONAL)
+        {
+            clusterLights.global.push_back(v);
+            continue;
+        }
+
+        vec3 viewPosition = vec3(app->cam.view * vec4(lsObj.position, 1.0f));
+        f32 range = app->gpuLights[v].clq.w;
+        f32 directionLength = glm::length(lsObj.direction);
+        if (light.type == L_SPOTLIGHT && directionLength > 0.0f)
+        {
+            vec3 viewDirection = vec3(app->cam.view * vec4(lsObj.direction / directionLength, 0.0f));
+            f32 angle = glm::radians(glm::clamp(light.outerCutOff[0], 0.0f, 90.0f));
+            AddClusterSpotLight(&clusterLights, viewPosition, viewDirection, angle, range, v);
+        }
+        else
+            AddClusterPointLight(&clusterLights, viewPosition, range, v);
+    }
+
+    UpdateClusterGrid(&app->clusterGrid, app->cam.projection, app->cam.zNear, app->cam.zFar);
+    AssignLightsToClusters(&app->clusterGrid, &clusterLights);
+    app->stats.clusterIndices = app->clusterGrid.indices.size();
+    app->stats.clusterMaxLights = app->clusterGrid.maxClusterLights;
+
+    // The grid size never changes, the index list grows like lightBuffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->clusterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, app->clusterGrid.offsetCount.size() * sizeof(u32), app->clusterGrid.offsetCount.data(), GL_STREAM_DRAW);
+
+    u32 count = app->clusterGrid.indices.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->clusterIndexBuffer);
+    if (count > app->clusterIndexCapacity || app->clusterIndexCapacity == 0)
+    {
+        app->clusterIndexCapacity = glm::max(count + count / 2, 256u);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, app->clusterIndexCapacity * sizeof(u32), NULL, GL_DYNAMIC_DRAW);
+    }
+    if (count > 0)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(u32), app->clusterGrid.indices.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void WaitAndDeleteFence(GLsync* fence)
+{
+    if (!*fence)
+        return;
+    while (glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        ;
+    glDeleteSync(*fence);
+    *fence = NULL;
+}
+
+// Any GL value that is never a valid name, so the next bind of every object is issued
+#define GL_STATE_UNKNOWN 0xFFFFFFFF
+
+void InvalidateGLState(GLStateCache* state)
+{
+    state->program = GL_STATE_UNKNOWN;
+    state->vertexArray = GL_STATE_UNKNOWN;
+    state->framebuffer = GL_STATE_UNKNOWN;
+    state->activeUnit = GL_STATE_UNKNOWN;
+    for (u32 i = 0; i < GL_STATE_TEXTURE_UNITS; ++i)
+    {
+        state->textureTargets[i] = GL_STATE_UNKNOWN;
+        state->textures[i] = GL_STATE_UNKNOWN;
+        state->samplers[i] = GL_STATE_UNKNOWN;
+    }
+    for (u32 i = 0; i < GLStateCap_Count; ++i)
+        state->caps[i] = -1;
+}
+
+void UseProgram(GLStateCache* state, GLuint program)
+{
+    if (state->program == program)
+    {
+        state->elided++;
+        return;
+    }
+    glUseProgram(program);
+    state->program = program;
+    state->issued++;
+}
+
+void BindVertexArray(GLStateCache* state, GLuint vertexArray)
+{
+    if (state->vertexArray == vertexArray)
+    {
+        state->elided++;
+        return;
+    }
+    glBindVertexArray(vertexArray);
+    state->vertexArray = vertexArray;
+    state->issued++;
+}
+
+void BindFramebuffer(GLStateCache* state, GLuint framebuffer)
+{
+    if (state->framebuffer == framebuffer)
+    {
+        state->elided++;
+        return;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    state->framebuffer = framebuffer;
+    state->issued++;
+}
+
+void BindTexture(GLStateCache* state, u32 unit, GLenum target, GLuint texture)
+{
+    ASSERT(unit < GL_STATE_TEXTURE_UNITS, "Texture unit not tracked by the GL state cache");
+    if (state->textures[unit] == texture && state->textureTargets[unit] == target)
+    {
+        state->elided++;
+        return;
+    }
+    if (state->activeUnit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        state->activeUnit = unit;
+    }
+    glBindTexture(target, texture);
+    state->textureTargets[unit] = target;
+    state->textures[unit] = texture;
+    state->issued++;
+}
+
+void BindSampler(GLStateCache* state, u32 unit, GLuint sampler)
+{
+    ASSERT(unit < GL_STATE_TEXTURE_UNITS, "Texture unit not tracked by the GL state cache");
+    if (state->samplers[unit] == sampler)
+    {
+        state->elided++;
+        return;
+    }
+    glBindSampler(unit, sampler);
+    state->samplers[unit] = sampler;
+    state->issued++;
+}
+
+void SetEnabled(GLStateCache* state, GLenum cap, bool enabled)
+{
+    i32 idx;
+    switch (cap)
+    {
+    case GL_DEPTH_TEST:         idx = GLStateCap_DepthTest; break;
+    case GL_STENCIL_TEST:       idx = GLStateCap_StencilTest; break;
+    case GL_BLEND:              idx = GLStateCap_Blend; break;
+    case GL_CULL_FACE:          idx = GLStateCap_CullFace; break;
+    case GL_SCISSOR_TEST:       idx = GLStateCap_ScissorTest; break;
+    case GL_PRIMITIVE_RESTART:  idx = GLStateCap_PrimitiveRestart; break;
+    default:                    idx = -1; break;
+    }
+
+    if (idx >= 0 && state->caps[idx] == (i32)enabled)
+    {
+        state->elided++;
+        return;
+    }
+    if (enabled)
+        glEnable(cap);
+    else
+        glDisable(cap);
+    if (idx >= 0)
+        state->caps[idx] = enabled;
+    state->issued++;
+}
+
+void CreateUniformRing(App* app, UniformRing* ring, u32 frameSize)
+{
+    GLint alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    ring->alignment = alignment;
+    ring->frameSize = (frameSize + alignment - 1) / alignment * alignment;
+
+    u32 size = ring->frameSize * UNIFORM_RING_FRAMES;
+    glGenBuffers(1, &ring->buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+    if (app->glExt.bufferStorage)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        app->glExt.bufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+        ring->mapped = (u8*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+    }
+    else
+    {
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+        ring->mapped = NULL;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void DestroyUniformRing(UniformRing* ring)
+{
+    for (u32 i = 0; i < UNIFORM_RING_FRAMES; ++i)
+        WaitAndDeleteFence(&ring->fences[i]);
+
+    if (ring->mapped)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &ring->buffer);
+    ring->buffer = 0;
+    ring->mapped = NULL;
+}
+
+/** Moves to the next frame region, making room for at least size bytes. */
+void BeginUniformRingFrame(App* app, UniformRing* ring, u32 size)
+{
+    if (size > ring->frameSize)
+    {
+        // Rare: the scene grew past the region size. Drain the GPU and reallocate.
+        DestroyUniformRing(ring);
+        CreateUniformRing(app, ring, size + size / 2);
+
+        for (u32 i = 0; i < app->meshes.size(); ++i)
+        {
+            BindInstanceAttributes(app->meshes[i].vertexArrayHandle, ring->buffer);
+            BindInstanceAttributes(app->meshes[i].depthVertexArrayHandle, ring->buffer);
+        }
+        BindInstanceAttributes(app->Svao, ring->buffer);
+        app->glState.vertexArray = 0;
+    }
+
+    ring->frame = (ring->frame + 1) % UNIFORM_RING_FRAMES;
+    ring->head = 0;
+    WaitAndDeleteFence(&ring->fences[ring->frame]);
+}
+
+void EndUniformRingFrame(UniformRing* ring)
+{
+    ring->fences[ring->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+u32 RingAlign(const UniformRing& ring, u32 size, u32 alignment = 0)
+{
+    // Least common multiple of the requested alignment and the uniform offset alignment
+    if (alignment == 0)
+        alignment = ring.alignment;
+    else
+    {
+        u32 a = alignment, b = ring.alignment;
+        while (b != 0) { u32 t = a % b; a = b; b = t; }
+        alignment = alignment / a * ring.alignment;
+    }
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/** Appends data to the current frame region and returns its offset in the buffer (a multiple of alignment). */
+u32 PushRingData(UniformRing* ring, const void* data, u32 size, u32 alignment = 0)
+{
+    // Frame regions start at multiples of the uniform alignment only, align the absolute offset
+    u32 regionStart = ring->frame * ring->frameSize;
+    ring->head = RingAlign(*ring, regionStart + ring->head, alignment) - regionStart;
+    ASSERT(ring->head + size <= ring->frameSize, "Uniform ring frame overflow, BeginUniformRingFrame was given a too small size");
+
+    u32 offset = ring->frame * ring->frameSize + ring->head;
+    if (ring->mapped)
+        memcpy(ring->mapped + offset, data, size);
+    else
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+    }
+
+    ring->head += size;
+    return offset;
+}
+
+/** Appends a block to the current frame region and binds it to the uniform binding point. */
+void PushUniforms(UniformRing* ring, u32 binding, const void* data, u32 size)
+{
+    u32 offset = PushRingData(ring, data, size);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring->buffer, offset, size);
+}
+
+/** Streams instance data, returns the baseInstance that makes the draws read it. */
+u32 PushInstances(UniformRing* ring, const InstanceData* instances, u32 count)
+{
+    u32 offset = PushRingData(ring, instances, count * sizeof(InstanceData), sizeof(InstanceData));
+    return offset / sizeof(InstanceData);
+}
+
+u32 UniformRingBlockSize(const UniformRing& ring)
+{
+    // Largest block pushed, rounded to the offset alignment
+    u32 size = glm::max((u32)sizeof(FrameUniforms), (u32)sizeof(DrawUniforms));
+    return RingAlign(ring, size);
+}
+
+void InitGPUScene(App* app)
+{
+    GPUScene& gpu = app->gpuScene;
+    glGenBuffers(1, &gpu.drawRecords);
+    glGenBuffers(1, &gpu.objectTransforms);
+    glGenBuffers(1, &gpu.commands);
+    glGenBuffers(1, &gpu.counters);
+    glGenBuffers(1, &gpu.groupBases);
+    glGenBuffers(1, &gpu.visibility);
+    glGenBuffers(1, &gpu.drawIDs);
+
+    glGenBuffers(1, &gpu.stats);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.stats);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GPU_CULL_STATS_COUNT * sizeof(u32), NULL, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &gpu.statsReadback);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, gpu.statsReadback);
+    glBufferData(GL_COPY_WRITE_BUFFER, GPU_CULL_STATS_FRAMES * GPU_CULL_STATS_COUNT * sizeof(u32), NULL, GL_STREAM_READ);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+/**
+ * Copies the culling counters of this frame into the readback ring, after reading back the slot's
+ * previous counters (GPU_CULL_STATS_FRAMES old, done by now) so the CPU doesn't wait on the culling.
+ */
+void ReadbackGPUCullStats(GPUScene* gpu)
+{
+    u32 slot = gpu->statsFrame % GPU_CULL_STATS_FRAMES;
+    GLintptr offset = slot * GPU_CULL_STATS_COUNT * sizeof(u32);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, gpu->statsReadback);
+    if (gpu->statsFences[slot])
+    {
+        WaitAndDeleteFence(&gpu->statsFences[slot]);
+        glGetBufferSubData(GL_COPY_WRITE_BUFFER, offset, sizeof(gpu->lastStats), gpu->lastStats);
+    }
+
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, gpu->stats);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, GPU_CULL_STATS_COUNT * sizeof(u32));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    gpu->statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gpu->statsFrame++;
+}
+
+/** Area of the screen sized render targets the frame covers. */
+ivec2 RenderViewport(const App* app)
+{
+    return ivec2(ScaledResolution(app->dynamicResolution, app->renderWidth), ScaledResolution(app->dynamicResolution, app->renderHeight));
+}
+
+/** Fraction of the screen sized render targets the frame covers, to rescale their texture coordinates. */
+vec2 RenderScale(const App* app)
+{
+    ivec2 viewport = RenderViewport(app);
+    return vec2((f32)viewport.x / app->renderWidth, (f32)viewport.y / app->renderHeight);
+}
+
+void InitHiZ(App* app)
+{
+    HiZPyramid& hiZ = app->hiZ;
+    if (hiZ.texture)
+        glDeleteTextures(1, &hiZ.texture);
+    hiZ.width = app->renderWidth;
+    hiZ.height = app->renderHeight;
+    hiZ.levels = 1;
+    while ((hiZ.width >> hiZ.levels) > 0 || (hiZ.height >> hiZ.levels) > 0)
+        hiZ.levels++;
+
+    glGenTextures(1, &hiZ.texture);
+    glBindTexture(GL_TEXTURE_2D, hiZ.texture);
+    glTexStorage2D(GL_TEXTURE_2D, hiZ.levels, GL_R32F, hiZ.width, hiZ.height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void BuildHiZ(App* app, GLuint depthTexture)
+{
+    HiZPyramid& hiZ = app->hiZ;
+    const Program& program = app->programs[app->hiZProgramIdx];
+    u32 depthUnit = GetSamplerUnit(program, "depth");
+    UseProgram(&app->glState, program.handle);
+    BindTexture(&app->glState, depthUnit, GL_TEXTURE_2D, depthTexture);
+
+    for (u32 level = 0; level < hiZ.levels; ++level)
+    {
+        u32 width = glm::max(hiZ.width >> level, 1u);
+        u32 height = glm::max(hiZ.height >> level, 1u);
+
+        glUniform1i(GetUniformLocation(program, "fromDepth"), level == 0);
+        glBindImageTexture(0, hiZ.texture, level > 0 ? level - 1 : 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, hiZ.texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    BindTexture(&app->glState, depthUnit, GL_TEXTURE_2D, 0);
+}
+
+void UploadGPUScene(App* app)
+{
+    GPUScene& gpu = app->gpuScene;
+    u32 objectCount = app->modelSceneObjects.size();
+
+    // One group per vertex array and texture set, its commands are stored contiguously.
+    // submeshGroup[submeshBase[m] + s] is the group of submesh s of model m.
+    std::vector<i32> submeshBase(app->models.size(), -1);
+    std::vector<u32> submeshGroup;
+    gpu.groups.clear();
+    for (u32 i = 0; i < objectCount; ++i)
+    {
+        u32 modelIdx = app->modelSceneObjects[i].modelIdx;
+        const Model& model = app->models[modelIdx];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        if (submeshBase[modelIdx] < 0)
+        {
+            submeshBase[modelIdx] = (i32)submeshGroup.size();
+            for (u32 s = 0; s < mesh.submeshes.size(); ++s)
+            {
+                u32 materialIdx = SubmeshMaterialIdx(app, model, s);
+                u32 g = 0;
+                while (g < gpu.groups.size() &&
+                       (gpu.groups[g].meshIdx != model.meshIdx || !SameMaterialTextures(app, gpu.groups[g].materialIdx, materialIdx)))
+                    g++;
+                if (g == gpu.groups.size())
+                {
+                    GPUDrawGroup group = {};
+                    group.meshIdx = model.meshIdx;
+                    group.materialIdx = materialIdx;
+                    gpu.groups.push_back(group);
+                }
+                submeshGroup.push_back(g);
+            }
+        }
+        for (u32 s = 0; s < mesh.submeshes.size(); ++s)
+            gpu.groups[submeshGroup[submeshBase[modelIdx] + s]].commandCount++;
+    }
+
+    std::vector<u32> groupBases(gpu.groups.size());
+    u32 drawCount = 0;
+    for (u32 g = 0; g < gpu.groups.size(); ++g)
+    {
+        gpu.groups[g].firstCommand = drawCount;
+        groupBases[g] = drawCount;
+        drawCount += gpu.groups[g].commandCount;
+    }
+
+    // Identity draw ids, only grows (the vertex arrays keep pointing at the same buffer)
+    if (drawCount > gpu.drawIDCapacity)
+    {
+        std::vector<u32> ids(drawCount);
+        for (u32 i = 0; i < drawCount; ++i)
+            ids[i] = i;
+        glBindBuffer(GL_ARRAY_BUFFER, gpu.drawIDs);
+        glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(u32), ids.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        gpu.drawIDCapacity = drawCount;
+    }
+
+    std::vector<GPUDrawRecord> records;
+    std::vector<glm::mat4> transforms(objectCount);
+    records.reserve(drawCount);
+    for (u32 i = 0; i < objectCount; ++i)
+    {
+        const ModelSceneObject& sobj = app->modelSceneObjects[i];
+        const Model& model = app->models[sobj.modelIdx];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        transforms[i] = sobj.transform;
+
+        for (u32 s = 0; s < mesh.submeshes.size(); ++s)
+        {
+            const Submesh& submesh = mesh.submeshes[s];
+            AABB aabb = TransformAABB(submesh.aabb, sobj.transform);
+
+            GPUDrawRecord record = {};
+            record.aabbMin = vec4(aabb.min, 1.0f);
+            record.aabbMax = vec4(aabb.max, 1.0f);
+            record.objectIndex = i;
+            record.group = submeshGroup[submeshBase[sobj.modelIdx] + s];
+            record.indexCount = submesh.indices.size();
+            record.firstIndex = submesh.indexOffset / sizeof(u32);
+            record.baseVertex = submesh.vertexOffset / submesh.vertexBufferLayout.stride;
+            record.materialIdx = SubmeshMaterialIdx(app, model, s);
+            records.push_back(record);
+        }
+    }
+    gpu.drawCount = drawCount;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.drawRecords);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(GPUDrawRecord), records.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.objectTransforms);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.groupBases);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, groupBases.size() * sizeof(u32), groupBases.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.commands);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, drawCount * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.counters);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gpu.groups.size() * sizeof(u32), NULL, GL_DYNAMIC_DRAW);
+
+    // Nothing was visible last frame: the late pass tests and draws everything once
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.visibility);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, drawCount * sizeof(u32), NULL, GL_DYNAMIC_DRAW);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    gpu.dirty = false;
+}
+
+// Must match the CULL_PASS_ values in CullingShader.glsl
+#define CULL_PASS_ALL   0
+#define CULL_PASS_EARLY 1
+#define CULL_PASS_LATE  2
+#define CULL_PASS_VISIBLE 3
+
+void CullObjectsGPU(App* app, const Frustum& frustum, i32 pass)
+{
+    GPUScene& gpu = app->gpuScene;
+    if (gpu.dirty)
+        UploadGPUScene(app);
+
+    if (pass == CULL_PASS_ALL || pass == CULL_PASS_EARLY)
+    {
+        // The counters of this frame are read back later, show the latest ones
+        app->stats = {};
+        app->stats.submeshesDrawn = gpu.lastStats[0];
+        app->stats.submeshesCulled = gpu.lastStats[1];
+        app->stats.submeshesOccluded = gpu.lastStats[2];
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.stats);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    if (gpu.drawCount == 0)
+        return;
+
+    // Commands not written by the culling keep a zero count and draw nothing
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.commands);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu.counters);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    const Program& program = app->programs[app->gpuCullingProgramIdx];
+    UseProgram(&app->glState, program.handle);
+    glUniform1i(GetUniformLocation(program, "pass"), pass);
+    glUniform1ui(GetUniformLocation(program, "drawCount"), gpu.drawCount);
+    glUniform4fv(GetUniformLocation(program, "frustumPlanes"), 6, glm::value_ptr(frustum.planes[0]));
+
+    if (pass == CULL_PASS_LATE)
+    {
+        glm::mat4 viewProjection = app->cam.projection * app->cam.view;
+        BindTexture(&app->glState, GetSamplerUnit(program, "hiZ"), GL_TEXTURE_2D, app->hiZ.texture);
+        glUniform2f(GetUniformLocation(program, "hiZSize"), (f32)app->hiZ.width, (f32)app->hiZ.height);
+        glUniform2fv(GetUniformLocation(program, "hiZUVScale"), 1, glm::value_ptr(RenderScale(app)));
+        glUniform1i(GetUniformLocation(program, "hiZLevels"), app->hiZ.levels);
+        glUniformMatrix4fv(GetUniformLocation(program, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpu.drawRecords);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gpu.commands);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, gpu.counters);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, gpu.groupBases);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, gpu.visibility);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, gpu.stats);
+    glDispatchCompute((gpu.drawCount + 63) / 64, 1, 1);
+
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // The last pass that counts
+    if (pass == CULL_PASS_ALL || pass == CULL_PASS_LATE)
+        ReadbackGPUCullStats(&gpu);
+}
+
+void BindMaterialTextures(App* app, u32 materialIdx)
+{
+    const Program& geoPass = app->programs[GeoPassProgramIdx(app)];
+    const Material& mat = app->materials[materialIdx];
+    if (HasTexture(app, mat.albedoTextureIdx))
+    {
+        // Material texture fields are indices into app->textures, missing ones sample white
+        BindTexture(&app->glState, GetSamplerUnit(geoPass, "tdiffuse"), GL_TEXTURE_2D, TextureHandle(app, mat.albedoTextureIdx));
+        BindTexture(&app->glState, GetSamplerUnit(geoPass, "tspecular"), GL_TEXTURE_2D, TextureHandle(app, mat.specularTextureIdx));
+    }
+}
+
+void UploadMaterials(App* app)
+{
+    if (app->materials.size() == app->materialBufferCount)
+        return;
+
+    std::vector<GPUMaterial> gpuMaterials(app->materials.size());
+    for (u32 i = 0; i < app->materials.size(); ++i)
+    {
+        const Material& mat = app->materials[i];
+        GPUMaterial& gpuMat = gpuMaterials[i];
+        gpuMat = {};
+        gpuMat.useTexture = HasTexture(app, mat.albedoTextureIdx) ? 1.0f : 0.0f;
+        if (mat.albedo.length() > 0.0f)
+        {
+            gpuMat.useColor = 1.0f;
+            gpuMat.albedo = mat.albedo;
+            gpuMat.emissive = mat.emissive;
+            gpuMat.smoothness = mat.smoothness;
+        }
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->materialBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gpuMaterials.size() * sizeof(GPUMaterial), gpuMaterials.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    app->materialBufferCount = app->materials.size();
+}
+
+/** Draws the commands the last GPU culling pass wrote, depthOnly with the position streams and no textures. */
+void DrawObjectsGPU(App* app, bool depthOnly)
+{
+    GPUScene& gpu = app->gpuScene;
+    if (gpu.drawCount == 0)
+        return;
+
+    DrawUniforms drawUniforms = {};
+    drawUniforms.useObjectBuffer = 1;
+    PushUniforms(&app->uniformRing, UNIFORM_BINDING_DRAW, &drawUniforms, sizeof(drawUniforms));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpu.drawRecords);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpu.objectTransforms);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu.commands);
+    if (app->glExt.multiDrawElementsIndirectCount)
+        glBindBuffer(GL_PARAMETER_BUFFER, gpu.counters);
+
+    for (u32 g = 0; g < gpu.groups.size(); ++g)
+    {
+        const GPUDrawGroup& group = gpu.groups[g];
+        const Mesh& mesh = app->meshes[group.meshIdx];
+        if (!depthOnly)
+            BindMaterialTextures(app, group.materialIdx);
+        BindVertexArray(&app->glState, depthOnly ? mesh.depthIndirectVertexArrayHandle : mesh.indirectVertexArrayHandle);
+
+        const void* indirect = (const void*)(u64)(group.firstCommand * sizeof(DrawElementsIndirectCommand));
+        if (app->glExt.multiDrawElementsIndirectCount)
+            app->glExt.multiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, indirect, g * sizeof(u32), group.commandCount, 0);
+        else
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, indirect, group.commandCount, 0);
+    }
+
+    if (app->glExt.multiDrawElementsIndirectCount)
+        glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+/** Moves the instance data and the commands of the render queue into the ring, once per frame. */
+void PushIndirectDraws(App* app)
+{
+    if (app->indirectCommands.empty())
+        return;
+
+    // The commands are rebased on the instances
+    u32 baseInstance = PushInstances(&app->uniformRing, app->instanceData.data(), app->instanceData.size());
+    for (u32 c = 0; c < app->indirectCommands.size(); ++c)
+        app->indirectCommands[c].baseInstance += baseInstance;
+    app->indirectCommandOffset = PushRingData(&app->uniformRing, app->indirectCommands.data(),
+                                              app->indirectCommands.size() * sizeof(DrawElementsIndirectCommand), sizeof(u32));
+}
+
+/** Draws what PushIndirectDraws pushed, depthOnly with the position streams and no textures. */
+void DrawObjectsIndirect(App* app, bool depthOnly)
+{
+    DrawUniforms drawUniforms = {};
+    PushUniforms(&app->uniformRing, UNIFORM_BINDING_DRAW, &drawUniforms, sizeof(drawUniforms));
+    if (app->indirectCommands.empty())
+        return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->uniformRing.buffer);
+    for (u32 g = 0; g < app->indirectGroups.size(); ++g)
+    {
+        const IndirectGroup& group = app->indirectGroups[g];
+        const Mesh& mesh = app->meshes[group.meshIdx];
+        if (!depthOnly)
+            BindMaterialTextures(app, group.materialIdx);
+        BindVertexArray(&app->glState, depthOnly ? mesh.depthVertexArrayHandle : mesh.vertexArrayHandle);
+
+        const void* indirect = (const void*)(u64)(app->indirectCommandOffset + group.firstCommand * sizeof(DrawElementsIndirectCommand));
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, indirect, group.commandCount, 0);
+        app->stats.drawCalls++;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    if (!depthOnly)
+        app->stats.submeshesDrawn += app->instanceData.size();
+}
+
+u32 FormatBytesPerPixel(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_R8:                 return 1;
+    case GL_RG8:                return 2;
+    case GL_RGB8:               return 3;
+    case GL_RGB16F:             return 6;
+    case GL_RGBA16F:            return 8;
+    case GL_RGBA32F:            return 16;
+    case GL_DEPTH_COMPONENT16:  return 2;
+    default:                    return 4; // RGBA8, RGB10_A2, RG16, R32F, 24/32 bit depth...
+    }
+}
+
+bool HasStencil(GLenum internalFormat)
+{
+    return internalFormat == GL_DEPTH24_STENCIL8 || internalFormat == GL_DEPTH32F_STENCIL8;
+}
+
+RenderTargetDesc MakeRenderTargetDesc(GLenum internalFormat, u32 width, u32 height, u32 samples = 1)
+{
+    RenderTargetDesc desc = { internalFormat, width, height, samples };
+    return desc;
+}
+
+/** Returns a free texture matching desc, creating it if the pool has none. */
+GLuint AcquireRenderTarget(RenderTargetPool* pool, const RenderTargetDesc& desc)
+{
+    for (u32 i = 0; i < pool->targets.size(); ++i)
+    {
+        PooledRenderTarget& target = pool->targets[i];
+        if (!target.inUse && target.desc.internalFormat == desc.internalFormat && target.desc.width == desc.width &&
+            target.desc.height == desc.height && target.desc.samples == desc.samples)
+        {
+            target.inUse = true;
+            target.lastUsedFrame = pool->frame;
+            return target.texture;
+        }
+    }
+
+    PooledRenderTarget target = {};
+    target.desc = desc;
+    target.inUse = true;
+    target.lastUsedFrame = pool->frame;
+    glGenTextures(1, &target.texture);
+    if (desc.samples > 1)
+    {
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, target.texture);
+        glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, desc.samples, desc.internalFormat, desc.width, desc.height, GL_TRUE);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, desc.internalFormat, desc.width, desc.height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    pool->targets.push_back(target);
+    pool->bytes += desc.width * desc.height * desc.samples * FormatBytesPerPixel(desc.internalFormat);
+    return target.texture;
+}
+
+/** Gives the texture back to the pool, it may be handed out again right away. */
+void ReleaseRenderTarget(RenderTargetPool* pool, GLuint texture)
+{
+    for (u32 i = 0; i < pool->targets.size(); ++i)
+    {
+        if (pool->targets[i].texture == texture)
+        {
+            ASSERT(pool->targets[i].inUse, "Render target released twice");
+            pool->targets[i].inUse = false;
+            pool->targets[i].lastUsedFrame = pool->frame;
+            return;
+        }
+    }
+    ASSERT(false, "Released a texture that doesn't belong to the render target pool");
+}
+
+/** Frees the released targets that nobody acquired for maxIdleFrames frames (0 frees every released one). */
+void TrimRenderTargetPool(RenderTargetPool* pool, u32 maxIdleFrames)
+{
+    for (u32 i = 0; i < pool->targets.size();)
+    {
+        PooledRenderTarget& target = pool->targets[i];
+        if (!target.inUse && pool->frame - target.lastUsedFrame >= maxIdleFrames)
+        {
+            glDeleteTextures(1, &target.texture);
+            pool->generation++;
+            pool->bytes -= target.desc.width * target.desc.height * target.desc.samples * FormatBytesPerPixel(target.desc.internalFormat);
+            target = pool->targets.back();
+            pool->targets.pop_back();
+        }
+        else
+            ++i;
+    }
+}
+
+void InitGPUTimers(GPUTimers* timers)
+{
+    for (u32 f = 0; f < GPU_TIMER_FRAMES; ++f)
+    {
+        glGenQueries(ARRAY_COUNT(timers->frames[f].queries), timers->frames[f].queries);
+        timers->frames[f].count = 0;
+    }
+}
+
+/** Reads back the oldest frame in flight if its queries are done, then reuses its slot. */
+void BeginGPUTimerFrame(GPUTimers* timers)
+{
+    timers->frame = (timers->frame + 1) % GPU_TIMER_FRAMES;
+    GPUTimerFrame& frame = timers->frames[timers->frame];
+    if (frame.count > 0)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.count], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 timestamps[GPU_TIMER_MAX_PASSES + 1];
+            for (u32 i = 0; i <= frame.count; ++i)
+                glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+            for (u32 i = 0; i < frame.count; ++i)
+            {
+                timers->passNames[i] = frame.names[i];
+                timers->passMs[i] = (timestamps[i + 1] - timestamps[i]) / 1000000.0f;
+            }
+            timers->passCount = frame.count;
+            timers->readbacks++;
+            timers->frameMs = (timestamps[frame.count] - timestamps[0]) / 1000000.0f;
+        }
+    }
+    frame.count = 0;
+}
+
+/** Timestamp at the start of the named pass, the next mark (or EndGPUTimerFrame) ends it. */
+void MarkGPUTimer(GPUTimers* timers, const char* name)
+{
+    GPUTimerFrame& frame = timers->frames[timers->frame];
+    if (frame.count == GPU_TIMER_MAX_PASSES)
+        return;
+    glQueryCounter(frame.queries[frame.count], GL_TIMESTAMP);
+    frame.names[frame.count++] = name;
+}
+
+void EndGPUTimerFrame(GPUTimers* timers)
+{
+    GPUTimerFrame& frame = timers->frames[timers->frame];
+    if (frame.count > 0)
+        glQueryCounter(frame.queries[frame.count], GL_TIMESTAMP);
+}
+
+/** Milliseconds the named pass took in the latest frame read back, 0 if it didn't run. */
+f32 GPUPassMs(const GPUTimers& timers, const char* name)
+{
+    for (u32 i = 0; i < timers.passCount; ++i)
+        if (strcmp(timers.passNames[i], name) == 0)
+            return timers.passMs[i];
+    return 0.0f;
+}
+
+u32 AddFrameGraphResource(FrameGraph* graph, const char* name, const RenderTargetDesc& desc, GLuint texture, bool imported)
+{
+    FrameGraphResource resource = {};
+    resource.name = name;
+    resource.desc = desc;
+    resource.texture = texture;
+    resource.imported = imported;
+    resource.firstPass = -1;
+    resource.lastPass = -1;
+    graph->resources.push_back(resource);
+    return graph->resources.size() - 1;
+}
+
+void ResetFrameGraph(FrameGraph* graph)
+{
+    graph->passes.clear();
+    graph->resources.clear();
+}
+
+/** Declares a texture that only lives during the frame, it holds pool memory only while the passes using it run. */
+u32 CreateFrameGraphTexture(FrameGraph* graph, const char* name, const RenderTargetDesc& desc)
+{
+    return AddFrameGraphResource(graph, name, desc, 0, false);
+}
+
+/** Declares a texture owned outside the graph, the passes writing to it are never culled. */
+u32 ImportFrameGraphTexture(FrameGraph* graph, const char* name, GLuint texture, const RenderTargetDesc& desc)
+{
+    return AddFrameGraphResource(graph, name, desc, texture, true);
+}
+
+/** Declares the default framebuffer, the passes writing to it are never culled. */
+u32 ImportFrameGraphBackbuffer(FrameGraph* graph, u32 width, u32 height)
+{
+    u32 resource = AddFrameGraphResource(graph, "Backbuffer", MakeRenderTargetDesc(GL_RGBA8, width, height), 0, true);
+    graph->resources[resource].backbuffer = true;
+    return resource;
+}
+
+/** Adds a pass, it runs in declaration order. data is handed back to execute through the pass. */
+u32 AddFrameGraphPass(FrameGraph* graph, const char* name, FrameGraphExecute execute, void* data)
+{
+    FrameGraphPass pass = {};
+    pass.name = name;
+    pass.execute = execute;
+    pass.data = data;
+    graph->passes.push_back(pass);
+    return graph->passes.size() - 1;
+}
+
+/** Attachment reads are read-only attachments, a depth buffer only tested against for instance. */
+void FrameGraphRead(FrameGraph* graph, u32 pass, u32 resource, FrameGraphAccess access = FrameGraphAccess_Sampled, u32 slot = 0)
+{
+    FrameGraphUse use = {};
+    use.resource = resource;
+    use.access = access;
+    use.slot = slot;
+    use.load = FrameGraphLoad_Load;
+    graph->passes[pass].reads.push_back(use);
+}
+
+/** A write replaces the whole content, a pass that keeps part of it must read the resource too. */
+void FrameGraphWrite(FrameGraph* graph, u32 pass, u32 resource, FrameGraphAccess access, u32 slot = 0)
+{
+    FrameGraphUse use = {};
+    use.resource = resource;
+    use.access = access;
+    use.slot = slot;
+    use.load = FrameGraphLoad_DontCare;
+    use.store = FrameGraphStore_Store;
+    graph->passes[pass].writes.push_back(use);
+}
+
+/** Renders to the resource at the attachment slot, starting from what load says and keeping the result unless store discards it. */
+void FrameGraphAttach(FrameGraph* graph, u32 pass, u32 resource, u32 slot, FrameGraphLoadAction load,
+                      FrameGraphStoreAction store = FrameGraphStore_Store, vec4 clearValue = vec4(0.0f))
+{
+    FrameGraphUse use = {};
+    use.resource = resource;
+    use.access = FrameGraphAccess_Attachment;
+    use.slot = slot;
+    use.load = load;
+    use.store = store;
+    use.clearValue = clearValue;
+    graph->passes[pass].writes.push_back(use);
+}
+
+/** Texture of the resource, only valid inside the passes using it. */
+GLuint FrameGraphTexture(const FrameGraph& graph, u32 resource)
+{
+    const FrameGraphResource& res = graph.resources[resource];
+    ASSERT(res.texture || res.backbuffer, "Frame graph resource used outside its lifetime");
+    return res.texture;
+}
+
+GLbitfield FrameGraphBarrierBit(FrameGraphAccess access)
+{
+    switch (access)
+    {
+        case FrameGraphAccess_Sampled:    return GL_TEXTURE_FETCH_BARRIER_BIT;
+        case FrameGraphAccess_Image:      return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+        case FrameGraphAccess_Attachment: return GL_FRAMEBUFFER_BARRIER_BIT;
+    }
+    return GL_ALL_BARRIER_BITS;
+}
+
+/**
+ * Culls the passes whose results nobody uses and computes the lifetimes and barriers of the rest.
+ * Walking back from the last pass, a pass is kept if it has side effects or writes a resource
+ * that is imported or read by a kept pass after it. Writing a resource ends the interest in
+ * its earlier content, reading it or loading it as attachment renews it. The attachments of a
+ * transient resource are discarded after its last use.
+ */
+void CompileFrameGraph(FrameGraph* graph)
+{
+    u32 resourceCount = graph->resources.size();
+    std::vector<bool> needed(resourceCount, false);
+    graph->passesCulled = 0;
+    for (i32 p = (i32)graph->passes.size() - 1; p >= 0; --p)
+    {
+        FrameGraphPass& pass = graph->passes[p];
+        bool keep = pass.sideEffect;
+        for (u32 w = 0; w < pass.writes.size() && !keep; ++w)
+            keep = needed[pass.writes[w].resource] || graph->resources[pass.writes[w].resource].imported;
+
+        pass.culled = !keep;
+        if (pass.culled)
+        {
+            graph->passesCulled++;
+            continue;
+        }
+
+        for (u32 w = 0; w < pass.writes.size(); ++w)
+            needed[pass.writes[w].resource] = pass.writes[w].load == FrameGraphLoad_Load;
+        for (u32 r = 0; r < pass.reads.size(); ++r)
+            needed[pass.reads[r].resource] = true;
+    }
+
+    // GL orders attachment writes and texture fetches by itself, only image stores need a
+    // barrier before anything else touches the texture
+    std::vector<bool> pendingImageStore(resourceCount, false);
+    graph->barriers = 0;
+    for (u32 r = 0; r < resourceCount; ++r)
+    {
+        graph->resources[r].firstPass = -1;
+        graph->resources[r].lastPass = -1;
+    }
+
+    for (u32 p = 0; p < graph->passes.size(); ++p)
+    {
+        FrameGraphPass& pass = graph->passes[p];
+        pass.barriers = 0;
+        if (pass.culled)
+            continue;
+
+        for (u32 u = 0; u < pass.reads.size() + pass.writes.size(); ++u)
+        {
+            const FrameGraphUse& use = u < pass.reads.size() ? pass.reads[u] : pass.writes[u - pass.reads.size()];
+            FrameGraphResource& resource = graph->resources[use.resource];
+            if (resource.firstPass < 0)
+                resource.firstPass = p;
+            resource.lastPass = p;
+
+            if (pendingImageStore[use.resource])
+            {
+                pass.barriers |= FrameGraphBarrierBit(use.access);
+                pendingImageStore[use.resource] = false;
+            }
+        }
+
+        for (u32 w = 0; w < pass.writes.size(); ++w)
+            if (pass.writes[w].access == FrameGraphAccess_Image)
+                pendingImageStore[pass.writes[w].resource] = true;
+
+        if (pass.barriers)
+            graph->barriers++;
+    }
+
+    for (u32 p = 0; p < graph->passes.size(); ++p)
+    {
+        FrameGraphPass& pass = graph->passes[p];
+        for (u32 w = 0; w < pass.writes.size(); ++w)
+        {
+            FrameGraphUse& use = pass.writes[w];
+            const FrameGraphResource& resource = graph->resources[use.resource];
+            if (use.access == FrameGraphAccess_Attachment && !resource.imported && resource.lastPass == (i32)p)
+                use.store = FrameGraphStore_Discard;
+        }
+    }
+}
+
+void FlushFrameGraphFramebuffers(App* app, FrameGraph* graph)
+{
+    // Deleting the bound framebuffer unbinds it behind the state cache's back
+    BindFramebuffer(&app->glState, 0);
+    for (u32 i = 0; i < graph->framebuffers.size(); ++i)
+        glDeleteFramebuffers(1, &graph->framebuffers[i].handle);
+    graph->framebuffers.clear();
+}
+
+/**
+ * Binds a framebuffer with the attachments of the pass, cached per attachment set, and sets the viewport
+ * to their size. Returns the framebuffer, 0 for the default one or if the pass has no attachments.
+ */
+GLuint BindFrameGraphAttachments(App* app, FrameGraph* graph, const FrameGraphPass& pass)
+{
+    FrameGraphFramebuffer key = {};
+    GLenum depthAttachment = GL_DEPTH_ATTACHMENT;
+    bool hasAttachments = false;
+    bool backbuffer = false;
+    u32 width = 0, height = 0;
+    for (u32 u = 0; u < pass.reads.size() + pass.writes.size(); ++u)
+    {
+        const FrameGraphUse& use = u < pass.reads.size() ? pass.reads[u] : pass.writes[u - pass.reads.size()];
+        if (use.access != FrameGraphAccess_Attachment)
+            continue;
+
+        const FrameGraphResource& resource = graph->resources[use.resource];
+        hasAttachments = true;
+        width = resource.desc.width;
+        height = resource.desc.height;
+        if (resource.backbuffer)
+            backbuffer = true;
+        else if (use.slot == FRAME_GRAPH_DEPTH_SLOT)
+        {
+            key.depth = resource.texture;
+            if (HasStencil(resource.desc.internalFormat))
+                depthAttachment = GL_DEPTH_STENCIL_ATTACHMENT;
+        }
+        else
+        {
+            ASSERT(use.slot < FRAME_GRAPH_MAX_COLOR_ATTACHMENTS, "Color attachment slot out of range");
+            key.colors[use.slot] = resource.texture;
+        }
+    }
+
+    if (!hasAttachments)
+        return 0;
+
+    if (pass.viewport.x > 0 && pass.viewport.y > 0)
+        glViewport(0, 0, pass.viewport.x, pass.viewport.y);
+    else
+        glViewport(0, 0, width, height);
+    if (backbuffer)
+    {
+        BindFramebuffer(&app->glState, 0);
+        return 0;
+    }
+
+    for (u32 i = 0; i < graph->framebuffers.size(); ++i)
+    {
+        const FrameGraphFramebuffer& framebuffer = graph->framebuffers[i];
+        if (framebuffer.depth == key.depth && memcmp(framebuffer.colors, key.colors, sizeof(key.colors)) == 0)
+        {
+            BindFramebuffer(&app->glState, framebuffer.handle);
+            return framebuffer.handle;
+        }
+    }
+
+    glGenFramebuffers(1, &key.handle);
+    BindFramebuffer(&app->glState, key.handle);
+
+    // Fragment output locations match the slots, the unused ones are GL_NONE
+    GLenum drawBuffers[FRAME_GRAPH_MAX_COLOR_ATTACHMENTS];
+    u32 drawBufferCount = 0;
+    for (u32 i = 0; i < FRAME_GRAPH_MAX_COLOR_ATTACHMENTS; ++i)
+    {
+        drawBuffers[i] = GL_NONE;
+        if (key.colors[i])
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, key.colors[i], 0);
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+            drawBufferCount = i + 1;
+        }
+    }
+    if (key.depth)
+        glFramebufferTexture2D(GL_FRAMEBUFFER, depthAttachment, GL_TEXTURE_2D, key.depth, 0);
+    glDrawBuffers(drawBufferCount, drawBuffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        ELOG("Frame graph pass %s has an incomplete framebuffer", pass.name);
+
+    graph->framebuffers.push_back(key);
+    return key.handle;
+}
+
+/** Attachment point of the use for glInvalidateFramebuffer, the default framebuffer has its own names. */
+GLenum FrameGraphAttachmentPoint(const FrameGraph& graph, const FrameGraphUse& use)
+{
+    bool depth = use.slot == FRAME_GRAPH_DEPTH_SLOT;
+    if (graph.resources[use.resource].backbuffer)
+        return depth ? GL_DEPTH : GL_COLOR;
+    if (depth && HasStencil(graph.resources[use.resource].desc.internalFormat))
+        return GL_DEPTH_STENCIL_ATTACHMENT;
+    return depth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + use.slot;
+}
+
+/** Clears the attachments loaded with FrameGraphLoad_Clear and invalidates the FrameGraphLoad_DontCare ones. */
+void ApplyFrameGraphLoadActions(FrameGraph* graph, const FrameGraphPass& pass)
+{
+    GLenum invalidate[FRAME_GRAPH_MAX_COLOR_ATTACHMENTS + 1];
+    u32 invalidateCount = 0;
+    for (u32 w = 0; w < pass.writes.size(); ++w)
+    {
+        const FrameGraphUse& use = pass.writes[w];
+        if (use.access != FrameGraphAccess_Attachment)
+            continue;
+
+        if (use.load == FrameGraphLoad_Clear)
+        {
+            // The stencil part is cleared to clearValue.y
+            if (use.slot == FRAME_GRAPH_DEPTH_SLOT && HasStencil(graph->resources[use.resource].desc.internalFormat))
+                glClearBufferfi(GL_DEPTH_STENCIL, 0, use.clearValue.x, (GLint)use.clearValue.y);
+            else if (use.slot == FRAME_GRAPH_DEPTH_SLOT)
+                glClearBufferfv(GL_DEPTH, 0, &use.clearValue.x);
+            else
+                glClearBufferfv(GL_COLOR, use.slot, &use.clearValue.x);
+        }
+        else if (use.load == FrameGraphLoad_DontCare && invalidateCount < ARRAY_COUNT(invalidate))
+            invalidate[invalidateCount++] = FrameGraphAttachmentPoint(*graph, use);
+    }
+
+    if (invalidateCount)
+    {
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, invalidateCount, invalidate);
+        graph->invalidations++;
+    }
+}
+
+/** Invalidates the attachments stored with FrameGraphStore_Discard, flagging their resources in discarded. */
+void ApplyFrameGraphStoreActions(App* app, FrameGraph* graph, const FrameGraphPass& pass, GLuint framebuffer, std::vector<bool>& discarded)
+{
+    GLenum invalidate[FRAME_GRAPH_MAX_COLOR_ATTACHMENTS + 1];
+    u32 invalidateCount = 0;
+    for (u32 w = 0; w < pass.writes.size(); ++w)
+    {
+        const FrameGraphUse& use = pass.writes[w];
+        if (use.access == FrameGraphAccess_Attachment && use.store == FrameGraphStore_Discard && invalidateCount < ARRAY_COUNT(invalidate))
+        {
+            invalidate[invalidateCount++] = FrameGraphAttachmentPoint(*graph, use);
+            discarded[use.resource] = true;
+        }
+    }
+
+    if (invalidateCount)
+    {
+        // The pass may have bound other framebuffers on its own
+        BindFramebuffer(&app->glState, framebuffer);
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, invalidateCount, invalidate);
+        graph->invalidations++;
+    }
+}
+
+/**
+ * Runs the kept passes in order, applying the load and store actions of their attachments around them.
+ * The transient textures are acquired from the render target pool right before the first pass using
+ * them and released after the last one, so a later texture with the same description reuses their
+ * memory within the frame. Their content is invalidated on release, it is never needed again.
+ * Every pass is timed on the GPU, see app->gpuTimers.
+ */
+void ExecuteFrameGraph(App* app, FrameGraph* graph)
+{
+    RenderTargetPool* pool = &app->renderTargets;
+    if (graph->poolGeneration != pool->generation)
+    {
+        FlushFrameGraphFramebuffers(app, graph);
+        graph->poolGeneration = pool->generation;
+    }
+
+    BeginGPUTimerFrame(&app->gpuTimers);
+
+    std::vector<bool> discarded(graph->resources.size(), false);
+    u32 liveBytes = 0;
+    graph->invalidations = 0;
+    graph->transientBytes = 0;
+    graph->peakTransientBytes = 0;
+    for (u32 p = 0; p < graph->passes.size(); ++p)
+    {
+        const FrameGraphPass& pass = graph->passes[p];
+        if (pass.culled)
+            continue;
+
+        for (u32 r = 0; r < graph->resources.size(); ++r)
+        {
+            FrameGraphResource& resource = graph->resources[r];
+            if (!resource.imported && resource.firstPass == (i32)p)
+            {
+                resource.texture = AcquireRenderTarget(pool, resource.desc);
+                u32 bytes = resource.desc.width * resource.desc.height * resource.desc.samples * FormatBytesPerPixel(resource.desc.internalFormat);
+                graph->transientBytes += bytes;
+                liveBytes += bytes;
+            }
+        }
+        graph->peakTransientBytes = glm::max(graph->peakTransientBytes, liveBytes);
+
+        MarkGPUTimer(&app->gpuTimers, pass.name);
+        if (pass.barriers)
+            glMemoryBarrier(pass.barriers);
+
+        GLuint framebuffer = BindFrameGraphAttachments(app, graph, pass);
+        ApplyFrameGraphLoadActions(graph, pass);
+        pass.execute(app, *graph, pass);
+        ApplyFrameGraphStoreActions(app, graph, pass, framebuffer, discarded);
+
+        for (u32 r = 0; r < graph->resources.size(); ++r)
+        {
+            FrameGraphResource& resource = graph->resources[r];
+            if (!resource.imported && resource.lastPass == (i32)p)
+            {
+                // Last used as a texture, the attachments were invalidated by their store action
+                if (!discarded[r])
+                {
+                    glInvalidateTexImage(resource.texture, 0);
+                    graph->invalidations++;
+                }
+                ReleaseRenderTarget(pool, resource.texture);
+                resource.texture = 0;
+                liveBytes -= resource.desc.width * resource.desc.height * resource.desc.samples * FormatBytesPerPixel(resource.desc.internalFormat);
+            }
+        }
+    }
+
+    EndGPUTimerFrame(&app->gpuTimers);
+}
+
+/**
+ * Declares the G-buffer targets of the frame with the layout picked by app->compactGBuffer:
+ *   classic: RGB16F position, RGB16F normal, RGB8 albedo, RGB16F specular/smoothness/alpha  (~25 B/px)
+ *   compact: RGB10A2 octahedral normal + smoothness + alpha, RGBA8 albedo + specular       (~12 B/px)
+ * Both add the 24 bit depth, which the compact light pass reads the position from.
+ */
+void DeclareGBuffer(App* app, FrameGraph* graph, DeferredFrame* frame)
+{
+    static const char* names[GBuffer_Count] = { "GBuffer Position", "GBuffer Normal", "GBuffer Albedo", "GBuffer Spec" };
+    GLenum formats[GBuffer_Count] = { GL_RGB16F, GL_RGB16F, GL_RGB8, GL_RGB16F };
+    if (app->compactGBuffer)
+    {
+        formats[GBuffer_Position] = GL_NONE;
+        formats[GBuffer_Normal] = GL_RGB10_A2;
+        formats[GBuffer_Albedo] = GL_RGBA8;
+        formats[GBuffer_Spec] = GL_NONE;
+    }
+
+    app->gbufferBytesPerPixel = 0;
+    for (u32 i = 0; i < GBuffer_Count; ++i)
+    {
+        frame->gbuffer[i] = -1;
+        if (formats[i] != GL_NONE)
+        {
+            frame->gbuffer[i] = CreateFrameGraphTexture(graph, names[i], MakeRenderTargetDesc(formats[i], app->renderWidth, app->renderHeight));
+            app->gbufferBytesPerPixel += FormatBytesPerPixel(formats[i]);
+        }
+    }
+
+    // The light volumes mark the pixels they cover in the stencil
+    GLenum depthFormat = app->lightingMode == LightingMode_Volumes ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+    frame->depth = CreateFrameGraphTexture(graph, "GBuffer Depth", MakeRenderTargetDesc(depthFormat, app->renderWidth, app->renderHeight));
+    app->gbufferBytesPerPixel += FormatBytesPerPixel(depthFormat);
+}
+
+/** Follows the framebuffer size (not while minimized), the transient targets pick the new size up on their own. */
+void ResizeRenderTargets(App* app)
+{
+    u32 width = app->displaySize.x;
+    u32 height = app->displaySize.y;
+    if (width == 0 || height == 0 || (width == app->renderWidth && height == app->renderHeight))
+        return;
+
+    app->renderWidth = width;
+    app->renderHeight = height;
+    InitHiZ(app);
+
+    // The old size won't be asked for again, don't wait for the targets to go idle
+    TrimRenderTargetPool(&app->renderTargets, 0);
+}
+
+void Init(App* app)
+{
+    // TODO: Initialize your resources here!
+    // - vertex buffers
+    // - element/index buffers
+    // - vaos
+    // - programs (and retrieve uniform indices)
+    // - textures
+
+    // The G-buffer is declared every frame in the frame graph, see DeclareGBuffer
+    app->renderWidth = app->displaySize.x;
+    app->renderHeight = app->displaySize.y;
+
+    //Light Sphere
+    u32 lats = 40, longs = 40;
+    int i, j;
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+    int indicator = 0;
+    for (i = 0; i <= lats; i++) {
+        double lat0 = glm::pi<double>() * (-0.5 + (double)(i - 1) / lats);
+        double z0 = sin(lat0);
+        double zr0 = cos(lat0);
+
+        double lat1 = glm::pi<double>() * (-0.5 + (double)i / lats);
+        double z1 = sin(lat1);
+        double zr1 = cos(lat1);
+
+        for (j = 0; j <= longs; j++) {
+            double lng = 2 * glm::pi<double>() * (double)(j - 1) / longs;
+            double x = cos(lng);
+            double y = sin(lng);
+
+            vertices.push_back(x * zr0);
+            vertices.push_back(y * zr0);
+            vertices.push_back(z0);
+            indices.push_back(indicator);
+            indicator++;
+
+            vertices.push_back(x * zr1);
+            vertices.push_back(y * zr1);
+            vertices.push_back(z1);
+            indices.push_back(indicator);
+            indicator++;
+        }
+        indices.push_back(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+    }
+
+    glGenVertexArrays(1, &app->Svao);
+    glBindVertexArray(app->Svao);
+
+    glGenBuffers(1, &app->Svbo);
+    glBindBuffer(GL_ARRAY_BUFFER, app->Svbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(1, &app->Sebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->Sebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+
+    app->Stri = indices.size();
+
+    //Light Cone: apex at the origin, base of radius 1 at z = 1. The ring goes through the
+    // corners of the circumscribed polygon, so the mesh contains the round cone.
+    const u32 coneSegments = 32;
+    f32 coneRadius = 1.0f / cosf(glm::pi<f32>() / coneSegments);
+    std::vector<GLfloat> coneVertices = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+    std::vector<GLuint> coneIndices;
+    for (u32 s = 0; s < coneSegments; ++s)
+    {
+        f32 angle = 2.0f * glm::pi<f32>() * s / coneSegments;
+        coneVertices.push_back(cosf(angle) * coneRadius);
+        coneVertices.push_back(sinf(angle) * coneRadius);
+        coneVertices.push_back(1.0f);
+
+        u32 current = 2 + s;
+        u32 next = 2 + (s + 1) % coneSegments;
+        coneIndices.insert(coneIndices.end(), { 0u, current, next });
+        coneIndices.insert(coneIndices.end(), { 1u, next, current });
+    }
+
+    glGenVertexArrays(1, &app->Cvao);
+    glBindVertexArray(app->Cvao);
+
+    glGenBuffers(1, &app->Cvbo);
+    glBindBuffer(GL_ARRAY_BUFFER, app->Cvbo);
+    glBufferData(GL_ARRAY_BUFFER, coneVertices.size() * sizeof(GLfloat), coneVertices.data(), GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(1, &app->Cebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->Cebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, coneIndices.size() * sizeof(GLuint), coneIndices.data(), GL_STATIC_DRAW);
+
+    app->Ctri = coneIndices.size();
+
+    //Quad buffer
+    float quadVertices[] = {
+        // positions        // texture Coords
+        -1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
+        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+         1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
+         1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+    };
+    // setup plane
+    glGenVertexArrays(1, &app->vao);
+    glGenBuffers(1, &app->vbo);
+    glBindVertexArray(app->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, app->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+
+    app->mode = Mode_TexturedQuad;
+
+
+    app->cam.cameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
+    app->cam.cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
+    app->cam.cameraDirection = glm::normalize(app->cam.cameraPos - app->cam.cameraTarget);
+
+
+    vec3 up = vec3(0.0f, 1.0f, 0.0f);
+    app->cam.cameraRight = glm::normalize(glm::cross(up, app->cam.cameraDirection));
+    app->cam.cameraFront = vec3(0.0f, 0.0f, -1.0f);
+    app->cam.cameraUp = vec3(0.0f, 1.0f, 0.0f);
+
+    InitGPUScene(app);
+    InitHiZ(app);
+    glGenBuffers(1, &app->lightBuffer);
+    glGenBuffers(1, &app->clusterBuffer);
+    glGenBuffers(1, &app->clusterIndexBuffer);
+    glGenBuffers(1, &app->materialBuffer);
+    CreateUniformRing(app, &app->uniformRing, KB(64));
+    BindInstanceAttributes(app->Svao, app->uniformRing.buffer);
+
+    // Texture 0 stands for "no texture", a white texel so it can be bound in place of a missing one
+    u8 white[4] = { 255, 255, 255, 255 };
+    Image whiteImage = {};
+    whiteImage.pixels = white;
+    whiteImage.size = ivec2(1, 1);
+    whiteImage.nchannels = 4;
+    whiteImage.stride = 4;
+    Texture whiteTexture = {};
+    whiteTexture.handle = CreateTexture2DFromImage(whiteImage);
+    whiteTexture.filepath = "<white>";
+    app->textures.push_back(whiteTexture);
+
+    // Built-in materials, uploaded with the model ones in the material buffer
+    app->defaultMaterialIdx = app->materials.size();
+    app->materials.push_back(Material());
+    app->materials.back().name = "Default";
+    app->materials.back().albedo = vec3(1.0f);
+
+    app->lightProxyMaterialIdx = app->materials.size();
+    app->materials.push_back(Material());
+    Material& lightProxyMaterial = app->materials.back();
+    lightProxyMaterial.name = "LightProxy";
+    lightProxyMaterial.albedo = vec3(1.0f, 0.0f, 0.0f);
+    lightProxyMaterial.emissive = vec3(1.0f, 0.0f, 0.0f);
+    lightProxyMaterial.smoothness = 32.0f / 256.0f;
+
+    u32 mLoaded = LoadModel(app, "Patrick\\Patrick.obj");
+    app->sceneModelIdx = mLoaded;
+
+    if (app->sceneParams.enabled)
+        GenerateScene(app, app->sceneParams, app->sceneModelIdx);
+    else
+    {
+        glm::mat4 trans = glm::mat4(1.0f);
+        trans = glm::translate(trans, vec3(0.0));
+
+        app->modelSceneObjects.push_back(ModelSceneObject());
+        ModelSceneObject& sobj = app->modelSceneObjects.back();
+
+        sobj.modelIdx = mLoaded;
+        sobj.transform = trans;
+
+        app->lightSceneObjects.push_back(LightSceneObject());
+        LightSceneObject& lsObj = app->lightSceneObjects.back();
+        lsObj.position = vec3(0.0f, 5.0f, 0.0f);
+        lsObj.direction = vec3(0.0f, -1.0f, 0.0f);
+        lsObj.light.type = L_POINT;
+        lsObj.light.intensity = 1.0f;
+        lsObj.light.constant = 1.0f;
+        lsObj.light.linear = 1.0f;
+        lsObj.light.quadratic = 1.0f;
+        lsObj.light.diffuse = vec3(0.8f);
+        lsObj.light.specular = 0.2f;
+        lsObj.light.cutOff[0] = 12.5f;
+        lsObj.light.outerCutOff[0] = 17.5f;
+        lsObj.light.cutOff[1] = glm::cos(glm::radians(lsObj.light.cutOff[0]));
+        lsObj.light.outerCutOff[1] = glm::cos(glm::radians(lsObj.light.outerCutOff[0]));
+    }
+
+    app->geoPassProgramIdx = LoadProgram(app, "GeoPassShader.glsl", "GEOMETRY_PASS");
+    app->lightPassProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS");
+    app->geoPassCompactProgramIdx = LoadProgram(app, "GeoPassShader.glsl", "GEOMETRY_PASS", "#define COMPACT_GBUFFER\n");
+    app->lightPassCompactProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS", "#define COMPACT_GBUFFER\n");
+    app->quadRenderProgramIdx = LoadProgram(app, "QuadRender.glsl", "QUAD_RENDER");
+    app->gpuCullingProgramIdx = LoadComputeProgram(app, "CullingShader.glsl", "GPU_CULLING");
+    app->hiZProgramIdx = LoadComputeProgram(app, "HiZShader.glsl", "HIZ_BUILD");
+    app->depthPrePassProgramIdx = LoadProgram(app, "GeoPassShader.glsl", "GEOMETRY_PASS", "#define DEPTH_ONLY\n");
+    app->tiledLightingProgramIdx = LoadComputeProgram(app, "TiledLightingShader.glsl", "TILED_LIGHTING");
+    app->tiledLightingCompactProgramIdx = LoadComputeProgram(app, "TiledLightingShader.glsl", "TILED_LIGHTING", "#define COMPACT_GBUFFER\n");
+    app->lightPassClusteredProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS", "#define CLUSTERED_LIGHTING\n");
+    app->lightPassClusteredCompactProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS", "#define COMPACT_GBUFFER\n#define CLUSTERED_LIGHTING\n");
+    app->lightPassMixedProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS", "#define MIXED_LIGHT_LOOP\n");
+    app->lightPassMixedCompactProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS", "#define COMPACT_GBUFFER\n#define MIXED_LIGHT_LOOP\n");
+    app->lightVolumeProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS", "#define LIGHT_VOLUMES\n");
+    app->lightVolumeCompactProgramIdx = LoadProgram(app, "LightPassShader.glsl", "LIGHT_PASS", "#define COMPACT_GBUFFER\n#define LIGHT_VOLUMES\n");
+
+    InitGPUTimers(&app->gpuTimers);
+
+    // The present pass upscales the dynamic resolution area, the render targets themselves are nearest filtered
+    glGenSamplers(1, &app->upscaleSampler);
+    glSamplerParameteri(app->upscaleSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(app->upscaleSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(app->upscaleSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(app->upscaleSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+}
+
+/**
+ * Swaps in the benchmark scene (LIGHT_BENCHMARK_OBJECTS objects, LIGHT_BENCHMARK_LIGHTS lights,
+ * fixed seed) and starts timing the light loops, see LightLoopBenchmark.
+ */
+void StartLightLoopBenchmark(App* app)
+{
+    LightLoopBenchmark& bench = app->lightLoopBenchmark;
+    bench.running = true;
+    bench.variant = 0;
+    bench.frames = 0;
+    bench.readbacks = app->gpuTimers.readbacks;
+    bench.totalMs[0] = bench.totalMs[1] = 0.0;
+
+    bench.cameraPos = app->cam.cameraPos;
+    bench.cameraFront = app->cam.cameraFront;
+    bench.lightingMode = app->lightingMode;
+    bench.perTypeLightLoops = app->perTypeLightLoops;
+    bench.animateLights = app->animateLights;
+    bench.dynamicResolution = app->dynamicResolution.enabled;
+    bench.resolutionScale = app->dynamicResolution.scale;
+    bench.sceneParams = app->sceneParams;
+    bench.modelSceneObjects = app->modelSceneObjects;
+    bench.lightSceneObjects = app->lightSceneObjects;
+    bench.selectedObject = app->selectedObject;
+
+    SceneGeneratorParams params;
+    params.enabled = true;
+    params.layout = SceneLayout_Grid;
+    params.objectCount = LIGHT_BENCHMARK_OBJECTS;
+    params.lightCount = LIGHT_BENCHMARK_LIGHTS;
+    params.seed = 1234;
+    GenerateScene(app, params, app->sceneModelIdx);
+    app->sceneParams = params;
+
+    bench.pointLights = bench.spotLights = 0;
+    for (u32 i = 0; i < app->lightSceneObjects.size(); ++i)
+    {
+        if (app->lightSceneObjects[i].light.type == L_SPOTLIGHT)
+            bench.spotLights++;
+        else
+            bench.pointLights++;
+    }
+}
+
+/** Pins the benchmark settings and accumulates the Lighting pass time of every GPU timer readback. */
+void UpdateLightLoopBenchmark(App* app)
+{
+    LightLoopBenchmark& bench = app->lightLoopBenchmark;
+    if (!bench.running)
+        return;
+
+    // Over the whole generated grid, at full resolution
+    app->cam.cameraPos = vec3(0.0f, 25.0f, 45.0f);
+    app->cam.cameraFront = glm::normalize(-app->cam.cameraPos);
+    app->lightingMode = LightingMode_Fullscreen;
+    app->perTypeLightLoops = bench.variant == 0;
+    app->animateLights = false;
+    app->dynamicResolution.enabled = false;
+    app->dynamicResolution.scale = 1.0f;
+
+    if (app->gpuTimers.readbacks == bench.readbacks)
+        return;
+    bench.readbacks = app->gpuTimers.readbacks;
+
+    // The first readbacks after a switch are frames of the previous variant
+    bench.frames++;
+    if (bench.frames <= LIGHT_BENCHMARK_WARMUP_FRAMES)
+        return;
+    bench.totalMs[bench.variant] += GPUPassMs(app->gpuTimers, "Lighting");
+    if (bench.frames < LIGHT_BENCHMARK_WARMUP_FRAMES + LIGHT_BENCHMARK_FRAMES)
+        return;
+
+    bench.frames = 0;
+    if (++bench.variant < 2)
+        return;
+
+    bench.running = false;
+    bench.averageMs[0] = (f32)(bench.totalMs[0] / LIGHT_BENCHMARK_FRAMES);
+    bench.averageMs[1] = (f32)(bench.totalMs[1] / LIGHT_BENCHMARK_FRAMES);
+    ILOG("Light loop benchmark, %u point and %u spot lights, %ux%u, %u frames: per type loops %.3f ms, mixed loop %.3f ms",
+         bench.pointLights, bench.spotLights, app->renderWidth, app->renderHeight, LIGHT_BENCHMARK_FRAMES, bench.averageMs[0], bench.averageMs[1]);
+
+    app->cam.cameraPos = bench.cameraPos;
+    app->cam.cameraFront = bench.cameraFront;
+    app->lightingMode = bench.lightingMode;
+    app->perTypeLightLoops = bench.perTypeLightLoops;
+    app->animateLights = bench.animateLights;
+    app->dynamicResolution.enabled = bench.dynamicResolution;
+    app->dynamicResolution.scale = bench.resolutionScale;
+
+    // Swapped back so the copies don't keep the saved scene memory around
+    app->sceneParams = bench.sceneParams;
+    app->modelSceneObjects.swap(bench.modelSceneObjects);
+    app->lightSceneObjects.swap(bench.lightSceneObjects);
+    bench.modelSceneObjects.clear();
+    bench.lightSceneObjects.clear();
+    bench.modelSceneObjects.shrink_to_fit();
+    bench.lightSceneObjects.shrink_to_fit();
+    app->selectedObject = bench.selectedObject;
+    app->sceneBVHDirty = true;
+}
+
+void Gui(App* app)
+{
+    ImGui::Begin("Info");
+    ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
+    ImGui::Combo("Select Texture", &app->textureOutputType, app->compactGBuffer ? "Position (full G-buffer only)\0Normal\0Albedo\0Final\0Depth\0"
+                                                                                : "Position\0Normal\0Albedo\0Final\0Depth\0");
+    ImGui::Checkbox("Compact G-buffer", &app->compactGBuffer);
+    ImGui::SameLine();
+    ImGui::Text("%u bytes/pixel", app->gbufferBytesPerPixel);
+    // The compact layout has no position target to show, the passes rebuild it from depth
+    if (app->compactGBuffer && app->textureOutputType == 0)
+        app->textureOutputType = 3;
+    ImGui::Combo("Lighting", &app->lightingMode, "Fullscreen quad\0Tiled compute\0Clustered\0Light volumes\0");
+    if (app->lightingMode == LightingMode_Clustered)
+        ImGui::Text("Clusters %ux%ux%u: %u light indices, max %u per cluster", CLUSTER_X, CLUSTER_Y, CLUSTER_Z,
+                    app->stats.clusterIndices, app->stats.clusterMaxLights);
+    if (app->lightingMode == LightingMode_Fullscreen)
+    {
+        // A/B of the light loops, same lights and pixels
+        ImGui::Checkbox("Per type light loops", &app->perTypeLightLoops);
+        ImGui::SameLine();
+        ImGui::Text("lighting %.3f ms (%u directional, %u point, %u spot)", GPUPassMs(app->gpuTimers, "Lighting"), app->firstPointLight,
+                    app->firstSpotLight - app->firstPointLight, (u32)app->gpuLights.size() - app->firstSpotLight);
+    }
+
+    // Replaces the scene, the results are also logged
+    const LightLoopBenchmark& bench = app->lightLoopBenchmark;
+    if (bench.running)
+        ImGui::Text("Light loop benchmark: %s loops, frame %u/%u", bench.variant == 0 ? "per type" : "mixed", bench.frames,
+                    LIGHT_BENCHMARK_WARMUP_FRAMES + LIGHT_BENCHMARK_FRAMES);
+    else if (ImGui::Button("Benchmark light loops"))
+        StartLightLoopBenchmark(app);
+    if (!bench.running && bench.averageMs[0] > 0.0f)
+    {
+        ImGui::SameLine();
+        ImGui::Text("per type %.3f ms | mixed %.3f ms (%u point, %u spot)", bench.averageMs[0], bench.averageMs[1], bench.pointLights, bench.spotLights);
+    }
+    ImGui::Text("Render targets: %u (%.1f MB)", (u32)app->renderTargets.targets.size(), app->renderTargets.bytes / (1024.0f * 1024.0f));
+    ImGui::Text("Frame graph: %u passes (%u culled) %u barriers %u invalidations, transient %.1f MB (peak %.1f MB)",
+                (u32)app->frameGraph.passes.size(), app->frameGraph.passesCulled, app->frameGraph.barriers, app->frameGraph.invalidations,
+                app->frameGraph.transientBytes / (1024.0f * 1024.0f), app->frameGraph.peakTransientBytes / (1024.0f * 1024.0f));
+    ImGui::TextWrapped("Everything works correctly but the final render do not display anything");
+
+    ImGui::Checkbox("Frustum culling", &app->frustumCulling);
+    ImGui::SameLine();
+    ImGui::Checkbox("Use BVH", &app->useBVH);
+    ImGui::Checkbox("Animate lights", &app->animateLights);
+    ImGui::Text("BVH nodes: objects %u lights %u", (u32)app->objectBVH.nodes.size(), (u32)app->lightBVH.nodes.size());
+    ImGui::Text("Selected object: %d", app->selectedObject);
+    ImGui::Checkbox("Occlusion culling", &app->occlusionCulling);
+    if (app->selectedObject >= 0 && app->selectedObject < (i32)app->modelSceneObjects.size())
+    {
+        ImGui::SameLine();
+        ImGui::Checkbox("Selected is occluder", &app->modelSceneObjects[app->selectedObject].isOccluder);
+    }
+    if (app->gpuCulling)
+    {
+        // Counted per draw record on the GPU, objects are not tracked
+        ImGui::Text("Submeshes drawn: %u culled: %u occluded: %u (GPU, %u frames late)", app->stats.submeshesDrawn, app->stats.submeshesCulled,
+                    app->stats.submeshesOccluded, GPU_CULL_STATS_FRAMES);
+    }
+    else
+    {
+        ImGui::Text("Objects drawn: %u culled: %u occluded: %u (%u occluders)", app->stats.objectsDrawn, app->stats.objectsCulled, app->stats.objectsOccluded, app->stats.occluders);
+        ImGui::Text("Submeshes drawn: %u culled: %u (%u draw calls)", app->stats.submeshesDrawn, app->stats.submeshesCulled, app->stats.drawCalls);
+    }
+    ImGui::Text("State changes issued: %u elided: %u", app->stats.stateChangesIssued, app->stats.stateChangesElided);
+    ImGui::Checkbox("Depth pre-pass", &app->depthPrePass);
+    ImGui::SameLine();
+    ImGui::Text("pre-pass %.3f ms + geometry %.3f ms", GPUPassMs(app->gpuTimers, "Depth pre-pass"), GPUPassMs(app->gpuTimers, "Geometry"));
+    ImGui::Text("GPU frame: %.3f ms", app->gpuTimers.frameMs);
+    DynamicResolution& resolution = app->dynamicResolution;
+    ImGui::Checkbox("Dynamic resolution", &resolution.enabled);
+    ImGui::SameLine();
+    ivec2 viewport = RenderViewport(app);
+    ImGui::Text("%.0f%% (%dx%d)", resolution.scale * 100.0f, viewport.x, viewport.y);
+    if (resolution.enabled)
+    {
+        ImGui::DragFloat("Target GPU ms", &resolution.targetMs, 0.1f, 1.0f, 100.0f, "%.1f");
+        ImGui::DragFloatRange2("Scale range", &resolution.minScale, &resolution.maxScale, 0.01f, 0.25f, 1.0f, "%.2f");
+    }
+    else
+        ImGui::SliderFloat("Resolution scale", &resolution.scale, 0.25f, 1.0f, "%.2f");
+    for (u32 i = 0; i < app->gpuTimers.passCount; ++i)
+        ImGui::BulletText("%s: %.3f ms", app->gpuTimers.passNames[i], app->gpuTimers.passMs[i]);
+    ImGui::Checkbox("Light culling", &app->lightCulling);
+    ImGui::SameLine();
+    if (ImGui::DragFloat("Light cutoff", &app->lightCutoff, 0.0005f, 0.0001f, 0.5f, "%.4f"))
+        app->sceneBVHDirty = true;
+    ImGui::Text("Lights visible: %u culled: %u", app->stats.lightsVisible, app->stats.lightsCulled);
+    ImGui::Checkbox("GPU culling", &app->gpuCulling);
+    if (app->gpuCulling)
+    {
+        ImGui::SameLine();
+        ImGui::Text("%u draw records, %s", app->gpuScene.drawCount, app->glExt.multiDrawElementsIndirectCount ? "indirect count" : "zeroed commands");
+        ImGui::Checkbox("Hi-Z occlusion (two-phase)", &app->gpuOcclusion);
+    }
+    ImGui::Text("Uniform ring: %u frames x %u KB (%s)", UNIFORM_RING_FRAMES, app->uniformRing.frameSize / 1024,
+                app->uniformRing.mapped ? "persistent map" : "glBufferSubData");
+
+    if (ImGui::CollapsingHeader("Scene Generator"))
+    {
+        SceneGeneratorParams& params = app->sceneParams;
+        ImGui::Text("Objects: %u  Lights: %u", (u32)app->modelSceneObjects.size(), (u32)app->lightSceneObjects.size());
+        ImGui::Combo("Layout", (int*)&params.layout, "Grid\0Random\0");
+        ImGui::InputInt("Objects", &params.objectCount, 100, 1000);
+        ImGui::InputInt("Lights", &params.lightCount, 100, 1000);
+        ImGui::InputScalar("Seed", ImGuiDataType_U32, &params.seed);
+        if (params.layout == SceneLayout_Grid)
+            ImGui::DragFloat("Spacing", &params.spacing, 0.1f, 0.1f, 100.0f);
+        else
+            ImGui::DragFloat("Extent", &params.extent, 1.0f, 1.0f, 1000.0f);
+        ImGui::DragFloatRange2("Light radius", &params.minLightRadius, &params.maxLightRadius, 0.1f, 0.1f, 100.0f);
+        ImGui::SliderFloat("Spot ratio", &params.spotLightRatio, 0.0f, 1.0f);
+        ImGui::SliderFloat("Occluder ratio", &params.occluderRatio, 0.0f, 1.0f);
+
+        if (params.objectCount < 0) params.objectCount = 0;
+        if (params.lightCount < 0)  params.lightCount = 0;
+
+        if (ImGui::Button("Generate"))
+        {
+            params.enabled = true;
+            GenerateScene(app, params, app->sceneModelIdx);
+        }
+    }
+
+    ImGui::End();
+}
+
+void UpdateCamera(App* app)
+{
+    app->cam.view = glm::lookAt(app->cam.cameraPos, app->cam.cameraPos + app->cam.cameraFront, app->cam.cameraUp);
+    app->cam.projection = glm::perspective(glm::radians(90.0f), float(app->renderWidth) / float(app->renderHeight), app->cam.zNear, app->cam.zFar);
+}
+
+void PickObject(App* app)
+{
+    // Ray through the mouse position, from the near to the far plane
+    vec2 ndc = vec2(2.0f * app->input.mousePos.x / app->displaySize.x - 1.0f,
+                    1.0f - 2.0f * app->input.mousePos.y / app->displaySize.y);
+    glm::mat4 invViewProjection = glm::inverse(app->cam.projection * app->cam.view);
+    vec4 nearPoint = invViewProjection * vec4(ndc, -1.0f, 1.0f);
+    vec4 farPoint = invViewProjection * vec4(ndc, 1.0f, 1.0f);
+    vec3 origin = vec3(nearPoint) / nearPoint.w;
+    vec3 target = vec3(farPoint) / farPoint.w;
+
+    u32 item;
+    f32 distance;
+    if (RaycastBVH(app->objectBVH, origin, glm::normalize(target - origin), glm::length(target - origin), &item, &distance))
+        app->selectedObject = (i32)item;
+    else
+        app->selectedObject = -1;
+}
+
+void Update(App* app)
+{
+    // You can handle app->input keyboard/mouse here
+    app->renderTargets.frame++;
+    TrimRenderTargetPool(&app->renderTargets, RENDER_TARGET_MAX_IDLE_FRAMES);
+    ResizeRenderTargets(app);
+    UpdateLightLoopBenchmark(app);
+    UpdateCamera(app);
+
+    // Every GPU frame time read back drives the render scale
+    if (app->gpuTimers.readbacks != app->resolutionReadbacks)
+    {
+        app->resolutionReadbacks = app->gpuTimers.readbacks;
+        UpdateDynamicResolution(&app->dynamicResolution, app->gpuTimers.frameMs, GPU_TIMER_FRAMES);
+    }
+
+    ReloadModifiedPrograms(app);
+
+    if (app->animateLights)
+    {
+        // Orbit the lights around the vertical axis to exercise the incremental BVH refit
+        f32 angle = app->deltaTime * 0.5f;
+        glm::mat4 rotation = glm::rotate(angle, vec3(0.0f, 1.0f, 0.0f));
+        for (u32 i = 0; i < app->lightSceneObjects.size(); ++i)
+            SetLightPosition(app, i, vec3(rotation * vec4(app->lightSceneObjects[i].position, 1.0f)));
+    }
+
+    UpdateSceneBVHs(app);
+
+    if (app->input.mouseButtons[LEFT] == BUTTON_PRESS)
+        PickObject(app);
+}
+
+/**
+ * Culls and draws the scene with the bound program: GPU culled (two-phase with the Hi-Z built from the
+ * depth drawn so far) or the CPU built indirect draws.
+ */
+void DrawScene(App* app, const FrameGraph& graph, const DeferredFrame& frame, GLuint program, bool depthOnly)
+{
+    if (app->gpuCulling)
+        DrawObjectsGPU(app, depthOnly);
+
+    if (app->gpuCulling && frame.twoPhaseOcclusion)
+    {
+        // Occlusion test against what the objects visible last frame left in the depth buffer,
+        // then draw the ones that became visible this frame
+        BuildHiZ(app, FrameGraphTexture(graph, frame.depth));
+        CullObjectsGPU(app, frame.frustum, CULL_PASS_LATE);
+
+        UseProgram(&app->glState, program);
+        DrawObjectsGPU(app, depthOnly);
+    }
+
+    if (!app->gpuCulling)
+        DrawObjectsIndirect(app, depthOnly);
+}
+
+void DepthPrePass(App* app, const FrameGraph& graph, const FrameGraphPass& pass)
+{
+    const DeferredFrame& frame = *(const DeferredFrame*)pass.data;
+    const Program& depthPrePass = app->programs[app->depthPrePassProgramIdx];
+    GLStateCache& state = app->glState;
+
+    SetEnabled(&state, GL_DEPTH_TEST, true);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    UseProgram(&state, depthPrePass.handle);
+    DrawScene(app, graph, frame, depthPrePass.handle, true);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void GeometryPass(App* app, const FrameGraph& graph, const FrameGraphPass& pass)
+{
+    const DeferredFrame& frame = *(const DeferredFrame*)pass.data;
+    const Program& geoPass = app->programs[GeoPassProgramIdx(app)];
+    GLStateCache& state = app->glState;
+
+    // The attachments were cleared by their load action
+    SetEnabled(&state, GL_DEPTH_TEST, true);
+
+    UseProgram(&state, geoPass.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STORAGE_BINDING_MATERIALS, app->materialBuffer);
+
+    if (frame.depthPrePass)
+    {
+        // Only the closest fragment of every pixel passes, the G-buffer is written once per pixel
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+
+        // The two-phase culling left only the late draws, emit everything visible this frame again
+        if (app->gpuCulling && frame.twoPhaseOcclusion)
+        {
+            CullObjectsGPU(app, frame.frustum, CULL_PASS_VISIBLE);
+            UseProgram(&state, geoPass.handle);
+        }
+
+        if (app->gpuCulling)
+            DrawObjectsGPU(app, false);
+        else
+            DrawObjectsIndirect(app, false);
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+    else
+        DrawScene(app, graph, frame, geoPass.handle, false);
+
+    // Light proxy spheres, all in one instanced draw
+    if (!app->lightProxyInstances.empty())
+    {
+        DrawUniforms drawUniforms = {};
+        PushUniforms(&app->uniformRing, UNIFORM_BINDING_DRAW, &drawUniforms, sizeof(drawUniforms));
+
+        u32 baseInstance = PushInstances(&app->uniformRing, app->lightProxyInstances.data(), app->lightProxyInstances.size());
+
+        // draw sphere
+        BindVertexArray(&state, app->Svao);
+        SetEnabled(&state, GL_PRIMITIVE_RESTART, true);
+        glPrimitiveRestartIndex(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+        glDrawElementsInstancedBaseInstance(GL_TRIANGLE_STRIP, app->Stri, GL_UNSIGNED_INT, NULL, app->lightProxyInstances.size(), baseInstance);
+        SetEnabled(&state, GL_PRIMITIVE_RESTART, false);
+        app->stats.drawCalls++;
+    }
+}
+
+void LightingPass(App* app, const FrameGraph& graph, const FrameGraphPass& pass)
+{
+    const DeferredFrame& frame = *(const DeferredFrame*)pass.data;
+    const Program& lightPass = app->programs[LightPassProgramIdx(app)];
+    GLStateCache& state = app->glState;
+
+    SetEnabled(&state, GL_DEPTH_TEST, false);
+    UseProgram(&state, lightPass.handle);
+
+    // Bind Textures
+    // Targets the layout doesn't have are not samplers of its light pass either
+    static const char* deferred_textures[GBuffer_Count] = { "gPosition", "gNormal", "gAlbedo", "gSpec" };
+    for (unsigned int count = 0; count < GBuffer_Count; ++count)
+        if (frame.gbuffer[count] >= 0)
+            BindTexture(&state, GetSamplerUnit(lightPass, deferred_textures[count]), GL_TEXTURE_2D, FrameGraphTexture(graph, frame.gbuffer[count]));
+    if (app->compactGBuffer)
+        BindTexture(&state, GetSamplerUnit(lightPass, "gDepth"), GL_TEXTURE_2D, FrameGraphTexture(graph, frame.depth));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, app->lightBuffer);
+
+    if (app->lightingMode == LightingMode_Clustered)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, app->clusterBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, app->clusterIndexBuffer);
+        vec2 depthScaleBias = ClusterDepthScaleBias(app->clusterGrid.zNear, app->clusterGrid.zFar);
+        glUniform1i(GetUniformLocation(lightPass, "globalLightCount"), (GLint)app->clusterLights.global.size());
+        glUniform2f(GetUniformLocation(lightPass, "clusterDepthScaleBias"), depthScaleBias.x, depthScaleBias.y);
+    }
+
+    // Render Quad
+    BindVertexArray(&state, app->vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+/** Tiled compute alternative to LightingPass, writes the result as an image. */
+void TiledLightingPass(App* app, const FrameGraph& graph, const FrameGraphPass& pass)
+{
+    const DeferredFrame& frame = *(const DeferredFrame*)pass.data;
+    const Program& tiledLighting = app->programs[TiledLightingProgramIdx(app)];
+    GLStateCache& state = app->glState;
+
+    UseProgram(&state, tiledLighting.handle);
+
+    static const char* deferred_textures[GBuffer_Count] = { "gPosition", "gNormal", "gAlbedo", "gSpec" };
+    for (u32 i = 0; i < GBuffer_Count; ++i)
+        if (frame.gbuffer[i] >= 0)
+            BindTexture(&state, GetSamplerUnit(tiledLighting, deferred_textures[i]), GL_TEXTURE_2D, FrameGraphTexture(graph, frame.gbuffer[i]));
+    BindTexture(&state, GetSamplerUnit(tiledLighting, "gDepth"), GL_TEXTURE_2D, FrameGraphTexture(graph, frame.depth));
+    glBindImageTexture(0, FrameGraphTexture(graph, frame.result), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, app->lightBuffer);
+
+    glm::mat4 inverseProjection = glm::inverse(app->cam.projection);
+    glUniformMatrix4fv(GetUniformLocation(tiledLighting, "inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+    glUniform2i(GetUniformLocation(tiledLighting, "viewportSize"), frame.viewport.x, frame.viewport.y);
+
+    // Must match TILE_SIZE in TiledLightingShader.glsl
+    const u32 tileSize = 16;
+    glDispatchCompute((frame.viewport.x + tileSize - 1) / tileSize, (frame.viewport.y + tileSize - 1) / tileSize, 1);
+}
+
+// The sphere mesh is inscribed in the unit sphere, scaled up a bit to contain the light range
+#define LIGHT_VOLUME_SPHERE_MARGIN 1.02f
+// Wider spots are drawn as spheres, the cone base would grow past the range
+#define LIGHT_VOLUME_MAX_CONE_ANGLE 60.0f
+
+/** Draws the unit volume of a point or spot light for LightVolumesPass. */
+void DrawLightVolume(App* app, const LightSceneObject& lsObj, f32 range, const glm::mat4& viewProjection, GLint transformLocation)
+{
+    GLStateCache& state = app->glState;
+
+    f32 directionLength = glm::length(lsObj.direction);
+    f32 outerAngle = glm::clamp(lsObj.light.outerCutOff[0], 0.0f, 90.0f);
+    if (lsObj.light.type == L_SPOTLIGHT && directionLength > 0.0f && outerAngle < LIGHT_VOLUME_MAX_CONE_ANGLE)
+    {
+        // Cone along the spot axis, its flat base at the range contains the lit part of the sphere
+        vec3 axis = lsObj.direction / directionLength;
+        vec3 right = glm::normalize(glm::cross(fabsf(axis.y) < 0.99f ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f), axis));
+        vec3 up = glm::cross(axis, right);
+        f32 baseRadius = range * tanf(glm::radians(outerAngle));
+        glm::mat4 model(vec4(right * baseRadius, 0.0f), vec4(up * baseRadius, 0.0f), vec4(axis * range, 0.0f), vec4(lsObj.position, 1.0f));
+
+        glm::mat4 transform = viewProjection * model;
+        glUniformMatrix4fv(transformLocation, 1, GL_FALSE, glm::value_ptr(transform));
+        BindVertexArray(&state, app->Cvao);
+        glDrawElements(GL_TRIANGLES, app->Ctri, GL_UNSIGNED_INT, NULL);
+    }
+    else
+    {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), lsObj.position);
+        model = glm::scale(model, vec3(range * LIGHT_VOLUME_SPHERE_MARGIN));
+
+        glm::mat4 transform = viewProjection * model;
+        glUniformMatrix4fv(transformLocation, 1, GL_FALSE, glm::value_ptr(transform));
+        BindVertexArray(&state, app->Svao);
+        SetEnabled(&state, GL_PRIMITIVE_RESTART, true);
+        glPrimitiveRestartIndex(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+        glDrawElements(GL_TRIANGLE_STRIP, app->Stri, GL_UNSIGNED_INT, NULL);
+        SetEnabled(&state, GL_PRIMITIVE_RESTART, false);
+    }
+    app->stats.drawCalls++;
+}
+
+/**
+ * Light volumes alternative to LightingPass. Each point or spot light marks the pixels whose surface
+ * lies inside its volume in the stencil (depth fails on the back faces minus the front ones), then
+ * shades only them, adding up into the result. Directional lights are fullscreen quads.
+ */
+void LightVolumesPass(App* app, const FrameGraph& graph, const FrameGraphPass& pass)
+{
+    const DeferredFrame& frame = *(const DeferredFrame*)pass.data;
+    const Program& lightVolume = app->programs[app->compactGBuffer ? app->lightVolumeCompactProgramIdx : app->lightVolumeProgramIdx];
+    GLStateCache& state = app->glState;
+
+    // The compact layout samples the depth, the volumes are tested against a copy
+    if (frame.volumeDepth != frame.depth)
+        glCopyImageSubData(FrameGraphTexture(graph, frame.depth), GL_TEXTURE_2D, 0, 0, 0, 0,
+                           FrameGraphTexture(graph, frame.volumeDepth), GL_TEXTURE_2D, 0, 0, 0, 0, frame.viewport.x, frame.viewport.y, 1);
+
+    UseProgram(&state, lightVolume.handle);
+
+    static const char* deferred_textures[GBuffer_Count] = { "gPosition", "gNormal", "gAlbedo", "gSpec" };
+    for (u32 i = 0; i < GBuffer_Count; ++i)
+        if (frame.gbuffer[i] >= 0)
+            BindTexture(&state, GetSamplerUnit(lightVolume, deferred_textures[i]), GL_TEXTURE_2D, FrameGraphTexture(graph, frame.gbuffer[i]));
+    if (app->compactGBuffer)
+        BindTexture(&state, GetSamplerUnit(lightVolume, "gDepth"), GL_TEXTURE_2D, FrameGraphTexture(graph, frame.depth));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, app->lightBuffer);
+    glUniform2f(GetUniformLocation(lightVolume, "viewportSize"), (f32)frame.viewport.x, (f32)frame.viewport.y);
+    GLint lightIndexLocation = GetUniformLocation(lightVolume, "lightIndex");
+    GLint transformLocation = GetUniformLocation(lightVolume, "volumeTransform");
+
+    // Every light adds up, the alpha keeps the opacity of the G-buffer
+    SetEnabled(&state, GL_BLEND, true);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ZERO);
+    SetEnabled(&state, GL_CULL_FACE, false);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LESS);
+    // Volumes poking through the far plane still mark the pixels in front of it
+    glEnable(GL_DEPTH_CLAMP);
+
+    glm::mat4 viewProjection = app->cam.projection * app->cam.view;
+    for (u32 v = 0; v < app->visibleLights.size(); ++v)
+    {
+        const LightSceneObject& lsObj = app->lightSceneObjects[app->visibleLights[v]];
+        f32 range = app->gpuLights[v].clq.w;
+        glUniform1i(lightIndexLocation, v);
+
+        if (lsObj.light.type == L_DIRECTIONAL)
+        {
+            SetEnabled(&state, GL_DEPTH_TEST, false);
+            SetEnabled(&state, GL_STENCIL_TEST, false);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            glUniformMatrix4fv(transformLocation, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+            BindVertexArray(&state, app->vao);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            app->stats.drawCalls++;
+            continue;
+        }
+        if (range <= 0.0f)
+            continue;
+
+        // Stencil: back faces behind the surface minus front faces behind it, any winding
+        SetEnabled(&state, GL_DEPTH_TEST, true);
+        SetEnabled(&state, GL_STENCIL_TEST, true);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+        DrawLightVolume(app, lsObj, range, viewProjection, transformLocation);
+
+        // Shade the marked pixels once, zeroing their stencil for the next light
+        SetEnabled(&state, GL_DEPTH_TEST, false);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_ZERO, GL_ZERO);
+        DrawLightVolume(app, lsObj, range, viewProjection, transformLocation);
+    }
+
+    glDisable(GL_DEPTH_CLAMP);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    SetEnabled(&state, GL_STENCIL_TEST, false);
+    SetEnabled(&state, GL_BLEND, false);
+}
+
+void PresentPass(App* app, const FrameGraph& graph, const FrameGraphPass& pass)
+{
+    const DeferredFrame& frame = *(const DeferredFrame*)pass.data;
+    const Program& quadRender = app->programs[app->quadRenderProgramIdx];
+    GLStateCache& state = app->glState;
+
+    // Show Final Texture
+    SetEnabled(&state, GL_DEPTH_TEST, false);
+    UseProgram(&state, quadRender.handle);
+
+    // The frame only covers the viewport part of the targets, stretched to the screen
+    GLuint outputTexture = frame.output >= 0 ? FrameGraphTexture(graph, frame.output) : 0;
+    u32 unit = GetSamplerUnit(quadRender, "uTexture");
+    BindTexture(&state, unit, GL_TEXTURE_2D, outputTexture);
+    BindSampler(&state, unit, app->upscaleSampler);
+    glUniform2fv(GetUniformLocation(quadRender, "uvScale"), 1, glm::value_ptr(frame.renderScale));
+
+    BindVertexArray(&state, app->vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    BindSampler(&state, unit, 0);
+    BindVertexArray(&state, 0);
+    UseProgram(&state, 0);
+}
+
+void Render(App* app)
 {
     switch (app->mode)
     {
@@ -668,183 +3355,173 @@ void Render(App* app)
                 // - bind the vao
                 // - glDrawElements() !!!
 
-                glBindFramebuffer(GL_FRAMEBUFFER, app->deferredFBO.ID);
-                glViewport(0, 0, app->deferredFBO.width, app->deferredFBO.height);
-
-                //Geometry Pass
-                glUseProgram(app->programGeoPass);
-
-                glm::mat4 view;
-                view = glm::lookAt(app->cam.cameraPos, app->cam.cameraPos + app->cam.cameraFront, app->cam.cameraUp);
-                glUniformMatrix4fv(glGetUniformLocation(app->programGeoPass, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
-                glm::mat4 projection;
-                projection = glm::perspective(glm::radians(90.0f), float(app->deferredFBO.width) / float(app->deferredFBO.height), 0.1f, 100.0f);
-                glUniformMatrix4fv(glGetUniformLocation(app->programGeoPass, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-                for (u32 i = 0; i < app->modelSceneObjects.size(); i++)
+                // Init, the program reloads and the ImGui backend bind objects behind the cache's back
+                GLStateCache& state = app->glState;
+                InvalidateGLState(&state);
+                state.issued = 0;
+                state.elided = 0;
+
+                glm::mat4 view = app->cam.view;
+                glm::mat4 projection = app->cam.projection;
+
+                // Frustum Culling
+                Frustum frustum = ExtractFrustum(projection * view);
+                bool twoPhaseOcclusion = app->gpuCulling && app->gpuOcclusion;
+                if (app->gpuCulling)
+                    CullObjectsGPU(app, frustum, twoPhaseOcclusion ? CULL_PASS_EARLY : CULL_PASS_ALL);
+                else
+                    CullObjects(app, frustum);
+
+                if (!app->gpuCulling)
+                    BuildRenderQueue(app, frustum);
+
+                CullLights(app, frustum);
+                u32 lCount = UploadLights(app);
+                if (app->lightingMode == LightingMode_Clustered)
+                    BuildLightClusters(app);
+
+                app->lightProxyInstances.clear();
+                for (u32 v = 0; v < lCount; v++)
                 {
-                    glUniformMatrix4fv(glGetUniformLocation(app->programGeoPass, "model"), 1, GL_FALSE, glm::value_ptr(app->modelSceneObjects[i].transform));
-
-                    Model& mod = app->models[app->modelSceneObjects[i].modelIdx];
-                    Mesh& mesh = app->meshes[mod.meshIdx];
-                    
-
-                    if (mod.materialIdx.size() > 0)
+                    const LightSceneObject& lsObj = app->lightSceneObjects[app->visibleLights[v]];
+                    if (lsObj.light.type != LightType::L_DIRECTIONAL)
                     {
-                        Material& mat = app->materials[mod.materialIdx[0]];
-
-                        u32 texCount = 0;
-                        if (mat.albedoTextureIdx > 0) 
-                        {
-                            glUniform1f(glGetUniformLocation(app->programGeoPass, "useTexture"), 1.0f);
-
-                            glActiveTexture(GL_TEXTURE0 + texCount);
-                            glUniform1i(glGetUniformLocation(app->programLightPass, "tdiffuse"), texCount);
-                            glBindTexture(GL_TEXTURE_2D, mat.albedoTextureIdx);
-                            texCount++;
-
-
-                            if (mat.specularTextureIdx > 0)
-                            {
-                                glActiveTexture(GL_TEXTURE0 + texCount);
-                                glUniform1i(glGetUniformLocation(app->programLightPass, "tspecular"), texCount);
-                                glBindTexture(GL_TEXTURE_2D, mat.specularTextureIdx);
-                            }
-                        }
-                        else
-                            glUniform1f(glGetUniformLocation(app->programGeoPass, "useTexture"), 0.0f);
-
-                        if (mat.albedo.length() > 0.0f)
-                        {
-                            glUniform1f(glGetUniformLocation(app->programGeoPass, "useColor"), 1.0f);
-                            glUniform3f(glGetUniformLocation(app->programGeoPass, "albedo"), mat.albedo.x, mat.albedo.y, mat.albedo.z);
-                            
-                            if (mat.emissive.length() > 0.0f)
-                                glUniform3f(glGetUniformLocation(app->programGeoPass, "emissive"), mat.emissive.x, mat.emissive.y, mat.emissive.z);
-                            
-                            glUniform1f(glGetUniformLocation(app->programGeoPass, "smoothness"), mat.smoothness);
-                        }
-                        else
-                            glUniform1f(glGetUniformLocation(app->programGeoPass, "useColor"), 0.0f);
-
+                        InstanceData instance = {};
+                        instance.model = glm::translate(glm::mat4(1.0f), lsObj.position);
+                        instance.materialIdx = app->lightProxyMaterialIdx;
+                        app->lightProxyInstances.push_back(instance);
                     }
-                    
-                    glBindVertexArray(mesh.vertexArrayHandle);
-                    glDrawElements(GL_TRIANGLES, mesh.indices.size(), GL_UNSIGNED_INT, nullptr);
                 }
 
-                for (u32 i = 0; i < app->lightSceneObjects.size(); i++)
+                if (!app->gpuCulling)
+                    BuildIndirectDraws(app);
+                else
                 {
-                    if (app->lightSceneObjects[i].light.type != LightType::L_DIRECTIONAL)
-                    {
-                        glm::mat4 trans = glm::mat4(1.0f);
-                        trans = glm::translate(trans, app->lightSceneObjects[i].position);
-                        glUniformMatrix4fv(glGetUniformLocation(app->programGeoPass, "model"), 1, GL_FALSE, glm::value_ptr(trans));
-
-                        glUniform1f(glGetUniformLocation(app->programGeoPass, "useColor"), 1.0f);
-                        glUniform1f(glGetUniformLocation(app->programGeoPass, "useTexture"), 0.0f);
-                        glUniform3f(glGetUniformLocation(app->programGeoPass, "albedo"), 1.0f, 0.0f, 0.0f);
-                        glUniform3f(glGetUniformLocation(app->programGeoPass, "emissive"), 1.0f, 0.0f, 0.0f);
-                        glUniform1f(glGetUniformLocation(app->programGeoPass, "smoothness"), 32.0f / 256.0f);
-
-                        // draw sphere
-                        glBindVertexArray(app->Svao);
-                        glEnable(GL_PRIMITIVE_RESTART);
-                        glPrimitiveRestartIndex(GL_PRIMITIVE_RESTART_FIXED_INDEX);
-                        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->Sebo);
-                        glDrawElements(GL_QUAD_STRIP, app->Stri, GL_UNSIGNED_INT, NULL);
-                    }
+                    app->instanceData.clear();
+                    app->indirectCommands.clear();
+                    app->indirectGroups.clear();
                 }
-
-                //LightPass
-                glUseProgram(app->programLightPass);
-
-                glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
-
-                //UploadLights
-
-                // Bind Textures
-                static const std::string deferred_textures[4] = { "gPosition", "gNormal", "gAlbedo", "gSpec" };
-                for (unsigned int count = 0; count < 4; ++count)
+                UploadMaterials(app);
+
+                // Every block pushed this frame: frame and draw constants (both GPU culling passes included),
+                // the instance data and the indirect commands, each with its worst case alignment padding
+                UniformRing& ring = app->uniformRing;
+                u32 uniformBlocks = 5;
+                u32 instanceBytes = (app->instanceData.size() + app->lightProxyInstances.size()) * sizeof(InstanceData) +
+                                    2 * RingAlign(ring, 1, sizeof(InstanceData));
+                u32 commandBytes = app->indirectCommands.size() * sizeof(DrawElementsIndirectCommand) + RingAlign(ring, 1, sizeof(u32));
+                BeginUniformRingFrame(app, &ring, uniformBlocks * UniformRingBlockSize(ring) + instanceBytes + commandBytes);
+
+                FrameUniforms frameUniforms = {};
+                frameUniforms.view = view;
+                frameUniforms.projection = projection;
+                frameUniforms.viewPos = app->cam.cameraPos;
+                frameUniforms.lightCount = lCount;
+                frameUniforms.inverseViewProjection = glm::inverse(projection * view);
+                frameUniforms.renderScale = RenderScale(app);
+                frameUniforms.firstPointLight = app->firstPointLight;
+                frameUniforms.firstSpotLight = app->firstSpotLight;
+                PushUniforms(&app->uniformRing, UNIFORM_BINDING_FRAME, &frameUniforms, sizeof(frameUniforms));
+                PushIndirectDraws(app);
+
+                // Passes declared in execution order, the graph drops those the shown output doesn't need
+                FrameGraph& graph = app->frameGraph;
+                ResetFrameGraph(&graph);
+
+                DeferredFrame frame = {};
+                frame.frustum = frustum;
+                frame.twoPhaseOcclusion = twoPhaseOcclusion;
+                frame.depthPrePass = app->depthPrePass;
+                frame.viewport = RenderViewport(app);
+                frame.renderScale = RenderScale(app);
+                DeclareGBuffer(app, &graph, &frame);
+                frame.result = CreateFrameGraphTexture(&graph, "Result", MakeRenderTargetDesc(GL_RGBA16F, app->renderWidth, app->renderHeight));
+                u32 backbuffer = ImportFrameGraphBackbuffer(&graph, app->displaySize.x, app->displaySize.y);
+
+                if (frame.depthPrePass)
                 {
-                    glActiveTexture(GL_TEXTURE0 + count);
-                    glUniform1i(glGetUniformLocation(app->programLightPass, deferred_textures[count].c_str()), count);
-                    glBindTexture(GL_TEXTURE_2D, app->deferredFBO.texturesID[count]);
+                    u32 prePass = AddFrameGraphPass(&graph, "Depth pre-pass", DepthPrePass, &frame);
+                    graph.passes[prePass].viewport = frame.viewport;
+                    FrameGraphAttach(&graph, prePass, frame.depth, FRAME_GRAPH_DEPTH_SLOT, FrameGraphLoad_Clear, FrameGraphStore_Store, vec4(1.0f, 0.0f, 0.0f, 0.0f));
                 }
 
-                u32 lCount = 0;
+                // The light proxies still write depth after the pre-pass
+                u32 geometry = AddFrameGraphPass(&graph, "Geometry", GeometryPass, &frame);
+                graph.passes[geometry].viewport = frame.viewport;
+                for (u32 i = 0; i < GBuffer_Count; ++i)
+                    if (frame.gbuffer[i] >= 0)
+                        FrameGraphAttach(&graph, geometry, frame.gbuffer[i], i, FrameGraphLoad_Clear);
+                FrameGraphAttach(&graph, geometry, frame.depth, FRAME_GRAPH_DEPTH_SLOT,
+                                 frame.depthPrePass ? FrameGraphLoad_Load : FrameGraphLoad_Clear, FrameGraphStore_Store, vec4(1.0f, 0.0f, 0.0f, 0.0f));
 
-                std::string unif_name;
-                for (u32 i = 0; i < app->lightSceneObjects.size(); i++) {
-                    unif_name = "lights[" + std::to_string(lCount) + "].";
-
-                    glUniform4f(glGetUniformLocation(app->programLightPass, (unif_name + "directionIntensity").c_str()), app->lightSceneObjects[i].direction.x, app->lightSceneObjects[i].direction.y, app->lightSceneObjects[i].direction.z, app->lightSceneObjects[i].light.intensity);
-                    glUniform4f(glGetUniformLocation(app->programLightPass, (unif_name + "diffuseSpecular").c_str()), app->lightSceneObjects[i].light.diffuse.x, app->lightSceneObjects[i].light.diffuse.y, app->lightSceneObjects[i].light.diffuse.z, app->lightSceneObjects[i].light.specular);
-                    
-                    if (app->lightSceneObjects[i].light.type != L_DIRECTIONAL)
+                if (app->lightingMode == LightingMode_Tiled)
+                {
+                    // The tiles read the depth bounds in both layouts
+                    u32 lighting = AddFrameGraphPass(&graph, "Tiled lighting", TiledLightingPass, &frame);
+                    for (u32 i = 0; i < GBuffer_Count; ++i)
+                        if (frame.gbuffer[i] >= 0)
+                            FrameGraphRead(&graph, lighting, frame.gbuffer[i]);
+                    FrameGraphRead(&graph, lighting, frame.depth);
+                    FrameGraphWrite(&graph, lighting, frame.result, FrameGraphAccess_Image);
+                }
+                else if (app->lightingMode == LightingMode_Volumes)
+                {
+                    u32 lighting = AddFrameGraphPass(&graph, "Light volumes", LightVolumesPass, &frame);
+                    graph.passes[lighting].viewport = frame.viewport;
+                    for (u32 i = 0; i < GBuffer_Count; ++i)
+                        if (frame.gbuffer[i] >= 0)
+                            FrameGraphRead(&graph, lighting, frame.gbuffer[i]);
+                    if (app->compactGBuffer)
                     {
-                        glUniform4f(glGetUniformLocation(app->programLightPass, (unif_name + "positionType").c_str()), app->lightSceneObjects[i].position.x, app->lightSceneObjects[i].position.y, app->lightSceneObjects[i].position.z, float(app->lightSceneObjects[i].light.type));
-                        glUniform4f(glGetUniformLocation(app->programLightPass, (unif_name + "clq").c_str()), app->lightSceneObjects[i].light.constant, app->lightSceneObjects[i].light.linear, app->lightSceneObjects[i].light.quadratic, 0.0f);
-
-
-                        if (app->lightSceneObjects[i].light.type == L_SPOTLIGHT)
-                            glUniform4f(glGetUniformLocation(app->programLightPass, (unif_name + "co").c_str()), app->lightSceneObjects[i].light.cutOff[1], app->lightSceneObjects[i].light.outerCutOff[1], 0.0f, 0.0f);
+                        // Sampled for the positions, so the stencil goes to a copy
+                        FrameGraphRead(&graph, lighting, frame.depth);
+                        frame.volumeDepth = CreateFrameGraphTexture(&graph, "Light volume depth", graph.resources[frame.depth].desc);
+                        FrameGraphAttach(&graph, lighting, frame.volumeDepth, FRAME_GRAPH_DEPTH_SLOT, FrameGraphLoad_DontCare, FrameGraphStore_Discard);
                     }
                     else
-                        glUniform4f(glGetUniformLocation(app->programLightPass, (unif_name + "positionType").c_str()), 0.0f, 0.0f, 0.0f, float(app->lightSceneObjects[i].light.type));
-
-
-                    lCount++;
-                    if (lCount == 203) break;
+                    {
+                        frame.volumeDepth = frame.depth;
+                        FrameGraphAttach(&graph, lighting, frame.depth, FRAME_GRAPH_DEPTH_SLOT, FrameGraphLoad_Load);
+                    }
+                    // Only the pixels some light reaches are written
+                    FrameGraphAttach(&graph, lighting, frame.result, 0, FrameGraphLoad_Clear);
+                }
+                else
+                {
+                    u32 lighting = AddFrameGraphPass(&graph, "Lighting", LightingPass, &frame);
+                    graph.passes[lighting].viewport = frame.viewport;
+                    for (u32 i = 0; i < GBuffer_Count; ++i)
+                        if (frame.gbuffer[i] >= 0)
+                            FrameGraphRead(&graph, lighting, frame.gbuffer[i]);
+                    if (app->compactGBuffer)
+                        FrameGraphRead(&graph, lighting, frame.depth);
+                    // The fullscreen quads cover every pixel, nothing to load
+                    FrameGraphAttach(&graph, lighting, frame.result, 0, FrameGraphLoad_DontCare);
                 }
-
-                glUniform1i(glGetUniformLocation(app->programLightPass, "count"), lCount);
-                vec3 cameraPos = app->cam.cameraPos;
-                glUniform3f(glGetUniformLocation(app->programLightPass, "viewPos"), cameraPos.x, cameraPos.y, cameraPos.z);
-
-                // Render Quad
-                glBindVertexArray(app->vao);
-                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-                glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
-
-                // Show Final Texture
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-
-                glUseProgram(app->programquadReder);
-
-                glActiveTexture(GL_TEXTURE0);
-                glUniform1i(glGetUniformLocation(app->programLightPass, "uTexture"), 0);
 
                 switch (app->textureOutputType)
                 {
-                case 0:
-                    glBindTexture(GL_TEXTURE_2D, app->deferredFBO.texturesID[0]);
-                    break;
-                case 1:
-                    glBindTexture(GL_TEXTURE_2D, app->deferredFBO.texturesID[1]);
-                    break;
-                case 2:
-                    glBindTexture(GL_TEXTURE_2D, app->deferredFBO.texturesID[2]);
-                    break;
-                case 3:
-                    glBindTexture(GL_TEXTURE_2D, app->deferredFBO.texturesID[4]);
-                    break;
-                case 4:
-                    glBindTexture(GL_TEXTURE_2D, app->deferredFBO.depthBufferTexture);
-                    glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, 0, 0, app->deferredFBO.width, app->deferredFBO.height, 0);
-                    break;
-                default:
-                    break;
+                case 0:  frame.output = frame.gbuffer[GBuffer_Position]; break;
+                case 1:  frame.output = frame.gbuffer[GBuffer_Normal]; break;
+                case 2:  frame.output = frame.gbuffer[GBuffer_Albedo]; break;
+                case 3:  frame.output = frame.result; break;
+                case 4:  frame.output = frame.depth; break;
+                default: frame.output = -1; break;
                 }
 
-                glBindVertexArray(app->vao);
-                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-                glBindVertexArray(0);
-                glUseProgram(0);
+                u32 present = AddFrameGraphPass(&graph, "Present", PresentPass, &frame);
+                graph.passes[present].sideEffect = true;
+                if (frame.output >= 0)
+                    FrameGraphRead(&graph, present, frame.output);
+                FrameGraphAttach(&graph, present, backbuffer, 0, FrameGraphLoad_DontCare);
+
+                CompileFrameGraph(&graph);
+                ExecuteFrameGraph(app, &graph);
+
+                app->stats.stateChangesIssued = state.issued;
+                app->stats.stateChangesElided = state.elided;
 
+                EndUniformRingFrame(&app->uniformRing);
             }
             break;
 
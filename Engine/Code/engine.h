@@ -5,7 +5,15 @@
 #pragma once
 
 #include "platform.h"
+#include "scene.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "jobs.h"
+#include "renderqueue.h"
+#include "resolution.h"
+#include "clusters.h"
 #include <glad/glad.h>
+#include <unordered_map>
 
 typedef glm::vec2  vec2;
 typedef glm::vec3  vec3;
@@ -14,11 +22,16 @@ typedef glm::ivec2 ivec2;
 typedef glm::ivec3 ivec3;
 typedef glm::ivec4 ivec4;
 
-struct FBO
+// Color targets of the geometry pass, GBuffer_X is written to fragment output location X.
+// The compact layout has no position (rebuilt from depth) nor specular target (packed into the
+// albedo alpha).
+enum GBufferTarget
 {
-    std::vector<u32> texturesID;
-    u32 ID = 0, width = 0, height = 0,
-        depthBuffer = 0, depthBufferTexture = 0;
+    GBuffer_Position,
+    GBuffer_Normal,
+    GBuffer_Albedo,
+    GBuffer_Spec,
+    GBuffer_Count
 };
 
 struct Image
@@ -35,12 +48,23 @@ struct Texture
     std::string filepath;
 };
 
+// Active program resources keyed by HashString(name)
+typedef std::unordered_map<u32, GLint> ProgramResourceTable;
+
 struct Program
 {
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp; // What is this for?
+    std::string        defines;            // Extra "#define X\n" lines of this variant
+    u64                lastWriteTimestamp; // The program is relinked when the file gets newer
+    bool               isCompute;
+
+    // Reflected after every link. Samplers get a fixed texture unit each.
+    ProgramResourceTable uniforms;      // location
+    ProgramResourceTable samplers;      // texture unit
+    ProgramResourceTable uniformBlocks; // block index
+    ProgramResourceTable storageBlocks; // block index
 };
 
 struct VertexBufferAttribute { u32 id; u32 quantity; u32 stride; };
@@ -57,6 +81,10 @@ struct Submesh
     u32 vertexOffset;
     u32 indexOffset;
     VertexBufferLayout vertexBufferLayout;
+
+    // Object space bounds computed at import time
+    AABB aabb;
+    BoundingSphere sphere;
 };
 
 struct Mesh
@@ -66,8 +94,18 @@ struct Mesh
     std::vector<u32>  indices;
 
     GLuint vertexArrayHandle;
+    GLuint indirectVertexArrayHandle; // Object id attribute instead of the instance stream
     GLuint vertexBufferHandle;
     GLuint indexBufferHandle;
+
+    // Tightly packed positions in the vertex buffer order, for the depth pre-pass
+    GLuint positionBufferHandle;
+    GLuint depthVertexArrayHandle;
+    GLuint depthIndirectVertexArrayHandle;
+
+    // Union of the submesh bounds
+    AABB aabb;
+    BoundingSphere sphere;
 };
 
 struct Material
@@ -86,7 +124,7 @@ struct Material
 struct Model
 {
     u32 meshIdx;
-    std::vector<u32> materialIdx;
+    std::vector<u32> materialIdx; // One per submesh
 };
 
 enum Mode
@@ -124,6 +162,7 @@ struct Light
 struct ModelSceneObject {
     glm::mat4x4 transform;
     u32 modelIdx;
+    bool isOccluder; // Rasterized into the software occlusion buffer
 };
 
 struct LightSceneObject {
@@ -132,6 +171,16 @@ struct LightSceneObject {
     Light light;
 };
 
+// std430 layout of the Light struct in LightPassShader.glsl
+struct GPULight
+{
+    vec4 positionType;
+    vec4 directionIntensity;
+    vec4 diffuseSpecular;
+    vec4 clq; // constant linear quadratic, range (where it falls under lightCutoff)
+    vec4 co;  // cutoff outercutoff (cosines)
+};
+
 struct Camera
 {
     vec3 cameraPos;
@@ -141,6 +190,449 @@ struct Camera
     vec3 cameraRight;
     vec3 cameraFront;
     vec3 cameraUp;
+
+    f32 zNear = 0.1f;
+    f32 zFar = 100.0f;
+
+    // Updated every frame by Update
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+
+struct FrameStats
+{
+    u32 objectsDrawn;
+    u32 objectsCulled;
+    u32 submeshesDrawn;
+    u32 submeshesCulled;
+    u32 submeshesOccluded; // GPU culling only
+    u32 objectsOccluded;
+    u32 occluders;
+    u32 lightsVisible;
+    u32 lightsCulled;
+    u32 clusterIndices;
+    u32 clusterMaxLights;
+    u32 drawCalls;
+    u32 stateChangesIssued;
+    u32 stateChangesElided;
+};
+
+// OpenGL entry points newer than the 4.3 profile loaded by glad. The platform layer
+// fills them in when the driver exposes them, otherwise they stay NULL.
+typedef void (APIENTRYP PFNMULTIDRAWELEMENTSINDIRECTCOUNTPROC)(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+typedef void (APIENTRYP PFNBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+#ifndef GL_PARAMETER_BUFFER
+#define GL_PARAMETER_BUFFER 0x80EE
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT   0x0080
+#endif
+
+struct GLExtensions
+{
+    PFNMULTIDRAWELEMENTSINDIRECTCOUNTPROC multiDrawElementsIndirectCount = NULL;
+    PFNBUFFERSTORAGEPROC                  bufferStorage = NULL;
+};
+
+// Texture units and capabilities tracked by the GL state cache
+#define GL_STATE_TEXTURE_UNITS 16
+
+enum GLStateCap
+{
+    GLStateCap_DepthTest,
+    GLStateCap_StencilTest,
+    GLStateCap_Blend,
+    GLStateCap_CullFace,
+    GLStateCap_ScissorTest,
+    GLStateCap_PrimitiveRestart,
+    GLStateCap_Count
+};
+
+// Shadow copy of the bindings Render changes the most, so redundant GL calls are skipped.
+// Code that binds these objects directly (resource setup, the ImGui backend restores its own
+// state) must happen outside Render or be followed by InvalidateGLState.
+struct GLStateCache
+{
+    GLuint program;
+    GLuint vertexArray;
+    GLuint framebuffer;
+    u32    activeUnit;
+    GLenum textureTargets[GL_STATE_TEXTURE_UNITS];
+    GLuint textures[GL_STATE_TEXTURE_UNITS];
+    GLuint samplers[GL_STATE_TEXTURE_UNITS];
+    i32    caps[GLStateCap_Count]; // -1 unknown, 0 disabled, 1 enabled
+
+    u32 issued;
+    u32 elided;
+};
+
+// Per-instance vertex attributes: draw record index of the GPU generated draws, model
+// matrix (four locations) and material index of the instanced draws. They stand in for
+// gl_DrawID/gl_BaseInstance, which GLSL 4.30 doesn't have: baseInstance offsets them.
+#define DRAW_ID_ATTRIBUTE           5
+#define INSTANCE_MODEL_ATTRIBUTE    6
+#define INSTANCE_MATERIAL_ATTRIBUTE 10
+
+// Storage buffer binding of the material array read by the geometry pass
+#define STORAGE_BINDING_MATERIALS 6
+
+// Uniform block binding points and their std140 layouts, shared with the shaders
+#define UNIFORM_BINDING_FRAME    0
+#define UNIFORM_BINDING_DRAW     1
+
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    vec3      viewPos;
+    i32       lightCount;
+    glm::mat4 inverseViewProjection;
+    vec2      renderScale; // Fraction of the render targets the frame covers, see DynamicResolution
+    i32       firstPointLight; // The light buffer is sorted by type: directional, point, spot
+    i32       firstSpotLight;
+};
+
+struct DrawUniforms
+{
+    u32 useObjectBuffer; // Transforms come from the GPU culling object buffer, not the instance stream
+    u32 pad[3];
+};
+
+// std430 layout of the Material struct in GeoPassShader.glsl, one per app->materials entry
+struct GPUMaterial
+{
+    vec3 albedo;
+    f32  useTexture;
+    vec3 emissive;
+    f32  useColor;
+    f32  smoothness;
+    f32  pad[3];
+};
+
+// Per-instance data of the instanced draws, streamed every frame
+struct InstanceData
+{
+    glm::mat4 model;
+    u32       materialIdx;
+    u32       pad[3];
+};
+
+// Indirect commands drawn with one glMultiDrawElementsIndirect: same vertex array and textures
+struct IndirectGroup
+{
+    u32 meshIdx;
+    u32 materialIdx; // Provides the textures, the other parameters are per draw
+    u32 firstCommand;
+    u32 commandCount;
+};
+
+// Frames the CPU can write ahead of the GPU in the uniform ring buffer
+#define UNIFORM_RING_FRAMES 3
+
+// Buffer split in one region per frame in flight. Every uniform block pushed during a frame
+// is appended to the current region and bound with glBindBufferRange, the per-instance
+// transforms are streamed the same way and read as instanced vertex attributes. A fence
+// per region keeps the CPU from overwriting data the GPU may still be reading.
+struct UniformRing
+{
+    GLuint buffer = 0;
+    u32    frameSize = 0;
+    u32    alignment = 256;
+    u8*    mapped = NULL; // Whole buffer, persistent and coherent (NULL without buffer storage)
+    u32    frame = 0;
+    u32    head = 0;
+    GLsync fences[UNIFORM_RING_FRAMES] = {};
+};
+
+// std430 layout shared with CullingShader.glsl, one per (object, submesh)
+struct GPUDrawRecord
+{
+    vec4 aabbMin;
+    vec4 aabbMax;
+    u32  objectIndex;
+    u32  group;
+    u32  indexCount;
+    u32  firstIndex;
+    i32  baseVertex;
+    u32  materialIdx;
+    u32  pad[2];
+};
+
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 baseInstance;
+};
+
+// Draw records sharing vertex array and material. Their commands are compacted
+// into [firstCommand, firstCommand + commandCount) of the command buffer.
+struct GPUDrawGroup
+{
+    u32 meshIdx;
+    u32 materialIdx; // Provides the textures, the other parameters are per draw record
+    u32 firstCommand;
+    u32 commandCount;
+};
+
+#define GPU_CULL_STATS_FRAMES 3
+#define GPU_CULL_STATS_COUNT  3
+
+struct GPUScene
+{
+    GLuint drawRecords;
+    GLuint objectTransforms;
+    GLuint commands;
+    GLuint counters;
+    GLuint groupBases;
+
+    // Per draw record, whether it passed the late culling pass last frame
+    GLuint visibility;
+
+    // Identity buffer read as an instanced attribute, so baseInstance gives the draw record index
+    GLuint drawIDs;
+    u32    drawIDCapacity = 0;
+
+    u32 drawCount = 0;
+    std::vector<GPUDrawGroup> groups;
+    bool dirty = true;
+
+    // Culling counters (drawn, frustum culled, occluded draw records), copied every frame into a
+    // slot of statsReadback and read back GPU_CULL_STATS_FRAMES frames later into lastStats
+    GLuint stats;
+    GLuint statsReadback;
+    GLsync statsFences[GPU_CULL_STATS_FRAMES] = {};
+    u32    statsFrame = 0;
+    u32    lastStats[GPU_CULL_STATS_COUNT] = {};
+};
+
+// Render targets with equal descriptions are interchangeable, the pool hands them out by description
+struct RenderTargetDesc
+{
+    GLenum internalFormat;
+    u32    width;
+    u32    height;
+    u32    samples; // 1: GL_TEXTURE_2D, more: GL_TEXTURE_2D_MULTISAMPLE
+};
+
+struct PooledRenderTarget
+{
+    RenderTargetDesc desc;
+    GLuint           texture;
+    bool             inUse;
+    u32              lastUsedFrame;
+};
+
+// Frames a released target is kept around for reuse before its memory is freed
+#define RENDER_TARGET_MAX_IDLE_FRAMES 60
+
+// Owns every screen sized texture. Long lived targets (the G-buffer) are acquired once and
+// released when they get recreated, transient ones are released as soon as their last reader
+// ran so a later pass of the same frame can reuse them. Released targets are freed once idle
+// for a while, or right away after a resize.
+struct RenderTargetPool
+{
+    std::vector<PooledRenderTarget> targets;
+    u32 frame = 0;
+    u32 bytes = 0;
+    u32 generation = 0; // Incremented when textures get deleted, their names may be reused
+};
+
+// Frame graph: every frame Render declares its passes and the textures they read and write,
+// the graph culls the passes nothing depends on, places memory barriers only where a pass
+// reads what an image store wrote, and acquires transient textures from the render target
+// pool right before their first use and releases them after their last one, so textures
+// whose lifetimes don't overlap share memory.
+struct App;
+struct FrameGraph;
+struct FrameGraphPass;
+
+typedef void (*FrameGraphExecute)(App* app, const FrameGraph& graph, const FrameGraphPass& pass);
+
+enum FrameGraphAccess
+{
+    FrameGraphAccess_Sampled,    // texture fetch
+    FrameGraphAccess_Image,      // image load/store
+    FrameGraphAccess_Attachment  // framebuffer attachment
+};
+
+// What an attachment starts the pass with. Load keeps the previous content (and the pass that
+// wrote it), DontCare lets the driver skip reading it back.
+enum FrameGraphLoadAction
+{
+    FrameGraphLoad_Load,
+    FrameGraphLoad_Clear,
+    FrameGraphLoad_DontCare
+};
+
+// Whether the attachment content is kept after the pass, Discard invalidates it. Transient
+// attachments are discarded after their last use on their own.
+enum FrameGraphStoreAction
+{
+    FrameGraphStore_Store,
+    FrameGraphStore_Discard
+};
+
+// Attachment slot of the depth buffer, color attachments use their fragment output location
+#define FRAME_GRAPH_DEPTH_SLOT 0xFFFFFFFF
+#define FRAME_GRAPH_MAX_COLOR_ATTACHMENTS 8
+
+struct FrameGraphUse
+{
+    u32              resource;
+    FrameGraphAccess access;
+    u32              slot; // Attachments only
+
+    // Attachment writes only
+    FrameGraphLoadAction  load;
+    FrameGraphStoreAction store;
+    vec4                  clearValue; // Depth in x, stencil in y
+};
+
+struct FrameGraphResource
+{
+    const char*      name;
+    RenderTargetDesc desc;
+    GLuint           texture;     // Valid while the resource is alive
+    bool             imported;    // Owned outside the graph, never acquired nor released
+    bool             backbuffer;  // Default framebuffer, only usable as attachment
+
+    // Compiled
+    i32 firstPass, lastPass;      // Lifetime among the passes that are kept, -1 if none uses it
+};
+
+struct FrameGraphPass
+{
+    const char*                name;
+    FrameGraphExecute          execute;
+    void*                      data;
+    bool                       sideEffect; // Never culled (presents to the screen)
+    ivec2                      viewport;   // Rendered area from the attachments origin, 0 covers them
+    std::vector<FrameGraphUse> reads;
+    std::vector<FrameGraphUse> writes;
+
+    // Compiled
+    bool       culled;
+    GLbitfield barriers; // glMemoryBarrier bits issued before the pass
+};
+
+struct FrameGraphFramebuffer
+{
+    GLuint colors[FRAME_GRAPH_MAX_COLOR_ATTACHMENTS];
+    GLuint depth;
+    GLuint handle;
+};
+
+struct FrameGraph
+{
+    std::vector<FrameGraphPass>     passes;
+    std::vector<FrameGraphResource> resources;
+
+    // Framebuffer objects per attachment set, flushed when the pool deletes textures
+    std::vector<FrameGraphFramebuffer> framebuffers;
+    u32 poolGeneration = 0;
+
+    // Last execution
+    u32 passesCulled = 0;
+    u32 barriers = 0;
+    u32 invalidations = 0;      // glInvalidateFramebuffer and glInvalidateTexImage calls
+    u32 transientBytes = 0;     // Sum of every transient texture
+    u32 peakTransientBytes = 0; // Most transient bytes alive at once
+};
+
+// GPU time of the frame graph passes from timestamp queries. A frame is read back
+// GPU_TIMER_FRAMES frames after it was issued, by then the queries are done and don't stall.
+#define GPU_TIMER_FRAMES 3
+#define GPU_TIMER_MAX_PASSES 16
+
+struct GPUTimerFrame
+{
+    GLuint      queries[GPU_TIMER_MAX_PASSES + 1]; // Before every pass and after the last one
+    const char* names[GPU_TIMER_MAX_PASSES];
+    u32         count;                             // Passes timed, 0 if nothing is in flight
+};
+
+struct GPUTimers
+{
+    GPUTimerFrame frames[GPU_TIMER_FRAMES];
+    u32 frame = 0;
+
+    // Latest frame read back
+    const char* passNames[GPU_TIMER_MAX_PASSES];
+    f32 passMs[GPU_TIMER_MAX_PASSES];
+    u32 passCount = 0;
+    f32 frameMs = 0.0f;
+    u32 readbacks = 0;  // Frames read back so far
+};
+
+// How the lighting pass shades the G-buffer
+enum LightingMode
+{
+    LightingMode_Fullscreen, // Every light for every pixel, fullscreen quad
+    LightingMode_Tiled,      // Compute shader, lights culled per 16x16 tile (TiledLightingShader.glsl)
+    LightingMode_Clustered,  // Fullscreen quad, lights assigned to froxels on the CPU (clusters.h)
+    LightingMode_Volumes,    // Sphere and cone per light, the stencil limits the shading to the pixels inside
+    LightingMode_Count
+};
+
+// Lighting pass GPU time of the per type light loops against the mixed loop (MIXED_LIGHT_LOOP),
+// on a fixed generated scene and camera. Each variant is timed over LIGHT_BENCHMARK_FRAMES read
+// back frames, after LIGHT_BENCHMARK_WARMUP_FRAMES frames that may still be of the other one.
+#define LIGHT_BENCHMARK_WARMUP_FRAMES (GPU_TIMER_FRAMES + 30)
+#define LIGHT_BENCHMARK_FRAMES        300
+#define LIGHT_BENCHMARK_OBJECTS       1024
+#define LIGHT_BENCHMARK_LIGHTS        1024
+
+struct LightLoopBenchmark
+{
+    bool running = false;
+    u32  variant;   // 0: per type loops, 1: mixed loop
+    u32  frames;    // GPU timer readbacks of the current variant
+    u32  readbacks; // Last gpuTimers.readbacks seen
+    f64  totalMs[2];
+
+    // Averages of the last run, 0 until one finished
+    f32  averageMs[2] = {};
+    u32  pointLights = 0, spotLights = 0;
+
+    // Settings the benchmark overrides, restored when it is done
+    vec3 cameraPos, cameraFront;
+    i32  lightingMode;
+    bool perTypeLightLoops;
+    bool animateLights;
+    bool dynamicResolution;
+    f32  resolutionScale;
+    SceneGeneratorParams          sceneParams;
+    std::vector<ModelSceneObject> modelSceneObjects;
+    std::vector<LightSceneObject> lightSceneObjects;
+    i32  selectedObject;
+};
+
+// Per frame data of the deferred passes, their frame graph passes point to it
+struct DeferredFrame
+{
+    Frustum frustum;
+    bool    twoPhaseOcclusion;
+    bool    depthPrePass;
+    ivec2   viewport;               // Rendered area of the screen sized targets
+    vec2    renderScale;            // viewport / target size
+    i32     gbuffer[GBuffer_Count]; // Frame graph resources, -1 for the targets the layout doesn't have
+    u32     depth;
+    u32     volumeDepth;            // Depth-stencil the light volumes are tested against
+    u32     result;
+    i32     output;                 // Resource shown on screen, -1 for none
+};
+
+// Max reduction mip chain of the G-buffer depth, for occlusion culling
+struct HiZPyramid
+{
+    GLuint texture = 0;
+    u32    width = 0, height = 0;
+    u32    levels = 0;
 };
 
 struct App
@@ -167,6 +659,91 @@ struct App
     std::vector<ModelSceneObject>  modelSceneObjects;
     std::vector<LightSceneObject>  lightSceneObjects;
 
+    // Stress scene generation (see scene.h)
+    SceneGeneratorParams sceneParams;
+    u32 sceneModelIdx;
+
+    // Culling
+    bool frustumCulling = true;
+    BoundsSoA objectBounds;
+    std::vector<u32> visibleObjects;
+    FrameStats stats;
+
+    // Hierarchies over the model scene objects and the non directional lights.
+    // Moved items are listed in the dirty vectors and refit on the next Update.
+    bool useBVH = true;
+    bool sceneBVHDirty = true;
+    bool animateLights = false;
+    BVH objectBVH;
+    BVH lightBVH;
+    std::vector<AABB> objectWorldBounds;
+    std::vector<u32> lightBVHItems;
+    std::vector<i32> lightToBVHItem;
+    std::vector<u32> dirtyObjects;
+    std::vector<u32> dirtyLights;
+
+    // Lights are culled with the sphere (or cone bounds) where their contribution
+    // falls under lightCutoff
+    bool lightCulling = true;
+    f32 lightCutoff = 1.0f / 256.0f;
+    std::vector<u32> lightQueryItems;
+    std::vector<u32> visibleLights;
+
+    // Visible lights packed every frame and uploaded in one go into lightBuffer, bucketed by type
+    // so the light pass runs a specialized loop per range instead of checking every light's type
+    std::vector<GPULight> gpuLights;
+    u32 firstPointLight = 0;
+    u32 firstSpotLight = 0;
+    std::vector<u32> lightSortScratch;
+    bool perTypeLightLoops = true; // Off compares against a single loop over every light
+    LightLoopBenchmark lightLoopBenchmark;
+    GLuint lightBuffer;
+    u32 lightBufferCapacity = 0;
+
+    // Clustered lighting: the froxel lists of the visible lights, uploaded once per frame
+    ClusterGrid clusterGrid;
+    ClusterLights clusterLights;
+    GLuint clusterBuffer;      // (offset, count) per cluster
+    GLuint clusterIndexBuffer; // Indices into lightBuffer
+    u32 clusterIndexCapacity = 0;
+
+    // Picking
+    i32 selectedObject = -1;
+
+    // Software occlusion culling
+    bool occlusionCulling = false;
+    OcclusionBuffer occlusionBuffer;
+    std::vector<u8> occlusionVisibility;
+
+    // GPU driven culling (see CullingShader.glsl)
+    bool gpuCulling = false;
+    bool gpuOcclusion = true; // Two-phase Hi-Z occlusion culling on top of the GPU culling
+    u32 gpuCullingProgramIdx;
+    u32 hiZProgramIdx;
+    GPUScene gpuScene;
+    HiZPyramid hiZ;
+
+    UniformRing uniformRing;
+
+    // Visible (object, submesh) packets of the CPU culled objects, sorted by state and depth.
+    // Cleared, not freed, every frame.
+    RenderQueue renderQueue;
+    std::vector<InstanceData> lightProxyInstances;
+
+    // Multi-draw indirect submission of the render queue, rebuilt every frame
+    std::vector<InstanceData> instanceData;
+    std::vector<DrawElementsIndirectCommand> indirectCommands;
+    std::vector<IndirectGroup> indirectGroups;
+    u32 indirectCommandOffset; // Of the commands in the ring, pushed once and drawn by every pass
+
+    // Material parameters for every draw, indexed per instance / draw record
+    GLuint materialBuffer;
+    u32 materialBufferCount = 0;
+    u32 defaultMaterialIdx;
+    u32 lightProxyMaterialIdx;
+    GLExtensions glExt;
+    GLStateCache glState;
+
     Camera cam;
 
     // program indices
@@ -187,24 +764,66 @@ struct App
     GLuint embeddedVertices;
     GLuint embeddedElements;
 
-    // Location of the texture uniform in the textured quad shader
-    GLuint programGeoPass;
-    GLuint programLightPass;
-    GLuint programquadReder;
-
-    FBO deferredFBO;
+    // Deferred shading program indices
+    u32 geoPassProgramIdx;
+    u32 lightPassProgramIdx;
+    u32 geoPassCompactProgramIdx;
+    u32 lightPassCompactProgramIdx;
+    u32 tiledLightingProgramIdx;
+    u32 tiledLightingCompactProgramIdx;
+    u32 lightPassClusteredProgramIdx;
+    u32 lightPassClusteredCompactProgramIdx;
+    u32 lightPassMixedProgramIdx;
+    u32 lightPassMixedCompactProgramIdx;
+    u32 lightVolumeProgramIdx;
+    u32 lightVolumeCompactProgramIdx;
+    u32 quadRenderProgramIdx;
+
+    RenderTargetPool renderTargets;
+    FrameGraph frameGraph;
+    GPUTimers gpuTimers;
+
+    // Depth only pass over the positions before the G-buffer one, which then shades each pixel once
+    // (GL_EQUAL test, no depth writes). Pays off above some overdraw, compare the pass timings.
+    bool depthPrePass = false;
+    u32 depthPrePassProgramIdx;
+
+    // Size of the G-buffer and the other screen sized targets, follows the framebuffer size.
+    // The frame covers a dynamicResolution.scale part of them, upscaled when presented.
+    u32 renderWidth = 0, renderHeight = 0;
+    DynamicResolution dynamicResolution;
+    u32 resolutionReadbacks = 0; // Of gpuTimers, fed to dynamicResolution
+    GLuint upscaleSampler;
+    bool compactGBuffer = false; // Octahedral normals and depth reconstructed position, see DeclareGBuffer
+    i32 lightingMode = LightingMode_Fullscreen;
+    u32 gbufferBytesPerPixel;
 
     //Sphere Buffer
     GLuint Svao, Svbo, Sebo, Stri;
 
+    // Spot light volume: unit cone along +Z, apex at the origin
+    GLuint Cvao, Cvbo, Cebo, Ctri;
+
     // VAO object to link our screen filling quad with our textured quad shader
     GLuint vao, vbo, ebo;
 
     i32 textureOutputType = 3;
 };
 
+u32 HashString(const char* str);
+
+/** Reflected uniform location, -1 (ignored by glUniform*) if the uniform is not active. */
+GLint GetUniformLocation(const Program& program, const char* name);
+
+/** Texture unit assigned to the sampler at reflection time, 0 if it is not active. */
+GLint GetSamplerUnit(const Program& program, const char* name);
+
 void Init(App* app);
 
+void SetObjectTransform(App* app, u32 objectIdx, const glm::mat4& transform);
+
+void SetLightPosition(App* app, u32 lightIdx, vec3 position);
+
 void Gui(App* app);
 
 void Update(App* app);
@@ -0,0 +1,141 @@
+//
+// jobs.cpp : Thread pool behind ParallelFor. Workers sleep on a condition variable until a
+// new batch is published, then grab iterations with an atomic counter.
+//
+
+#include "jobs.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+struct JobSystem
+{
+    std::vector<std::thread> threads;
+    std::mutex               mutex;
+    std::condition_variable  wakeCondition;
+    std::condition_variable  doneCondition;
+
+    // Current batch, protected by the mutex except for the atomic counters
+    JobFunction      function = NULL;
+    void*            data = NULL;
+    u32              count = 0;
+    u64              generation = 0;
+    u32              activeWorkers = 0;
+    bool             quit = false;
+    std::atomic<u32> nextIndex;
+    std::atomic<u32> finishedCount;
+};
+
+static JobSystem GlobalJobSystem;
+
+static void RunIterations(JobSystem* jobs, JobFunction function, void* data, u32 count)
+{
+    u32 index;
+    while ((index = jobs->nextIndex.fetch_add(1)) < count)
+    {
+        function(data, index);
+        jobs->finishedCount.fetch_add(1);
+    }
+}
+
+static void WorkerThread(JobSystem* jobs)
+{
+    u64 lastGeneration = 0;
+    for (;;)
+    {
+        JobFunction function;
+        void* data;
+        u32 count;
+        {
+            std::unique_lock<std::mutex> lock(jobs->mutex);
+            jobs->wakeCondition.wait(lock, [&] { return jobs->quit || jobs->generation != lastGeneration; });
+            if (jobs->quit)
+                return;
+            lastGeneration = jobs->generation;
+            function = jobs->function;
+            data = jobs->data;
+            count = jobs->count;
+            jobs->activeWorkers++;
+        }
+
+        RunIterations(jobs, function, data, count);
+
+        {
+            std::lock_guard<std::mutex> lock(jobs->mutex);
+            jobs->activeWorkers--;
+        }
+        jobs->doneCondition.notify_all();
+    }
+}
+
+void InitJobSystem(u32 threadCount)
+{
+    JobSystem* jobs = &GlobalJobSystem;
+    if (!jobs->threads.empty())
+        return;
+
+    if (threadCount == 0)
+    {
+        u32 hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    jobs->quit = false;
+    jobs->nextIndex = 0;
+    jobs->finishedCount = 0;
+    for (u32 i = 0; i < threadCount; ++i)
+        jobs->threads.push_back(std::thread(WorkerThread, jobs));
+
+    ILOG("Job system started with %u worker threads", threadCount);
+}
+
+void ShutdownJobSystem()
+{
+    JobSystem* jobs = &GlobalJobSystem;
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->quit = true;
+    }
+    jobs->wakeCondition.notify_all();
+
+    for (u32 i = 0; i < jobs->threads.size(); ++i)
+        jobs->threads[i].join();
+    jobs->threads.clear();
+}
+
+u32 GetJobThreadCount()
+{
+    return (u32)GlobalJobSystem.threads.size() + 1;
+}
+
+void ParallelFor(u32 count, JobFunction function, void* data)
+{
+    JobSystem* jobs = &GlobalJobSystem;
+
+    if (jobs->threads.empty() || count <= 1)
+    {
+        for (u32 i = 0; i < count; ++i)
+            function(data, i);
+        return;
+    }
+
+    {
+        // A worker may still be leaving the previous batch (it woke up after that batch
+        // was already done). Let it go before resetting the counters.
+        std::unique_lock<std::mutex> lock(jobs->mutex);
+        jobs->doneCondition.wait(lock, [&] { return jobs->activeWorkers == 0; });
+        jobs->function = function;
+        jobs->data = data;
+        jobs->count = count;
+        jobs->nextIndex = 0;
+        jobs->finishedCount = 0;
+        jobs->generation++;
+    }
+    jobs->wakeCondition.notify_all();
+
+    RunIterations(jobs, function, data, count);
+
+    std::unique_lock<std::mutex> lock(jobs->mutex);
+    jobs->doneCondition.wait(lock, [&] { return jobs->finishedCount.load() == count; });
+}
@@ -0,0 +1,27 @@
+//
+// jobs.h: This file contains a minimal job system: a pool of worker threads that run the
+// iterations of a parallel for. The calling thread takes part in the work too.
+//
+
+#pragma once
+
+#include "platform.h"
+
+typedef void (*JobFunction)(void* data, u32 index);
+
+/**
+ * Starts the worker threads. With threadCount == 0 it uses one worker per hardware
+ * thread minus the calling one.
+ */
+void InitJobSystem(u32 threadCount = 0);
+
+void ShutdownJobSystem();
+
+/** Number of threads that execute jobs, including the calling thread. */
+u32 GetJobThreadCount();
+
+/**
+ * Calls function(data, i) for every i in [0, count) spread across the worker threads,
+ * and returns once all of them have finished.
+ */
+void ParallelFor(u32 count, JobFunction function, void* data);
@@ -0,0 +1,231 @@
+//
+// occlusion.cpp : Software depth rasterizer for occlusion culling. Triangles are binned into
+// screen tiles, each tile is rasterized by a job evaluating the edge functions for 4 pixels
+// at once with SSE, and then reduced into the hierarchical depth buffer.
+//
+
+#include "occlusion.h"
+#include "jobs.h"
+#include <float.h>
+#include <immintrin.h>
+
+void ClearOcclusionBuffer(OcclusionBuffer* buffer, const glm::mat4& viewProjection)
+{
+    buffer->width = OCCLUSION_WIDTH;
+    buffer->height = OCCLUSION_HEIGHT;
+    buffer->tilesX = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+    buffer->tilesY = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+    buffer->hizWidth = OCCLUSION_WIDTH / OCCLUSION_HIZ_BLOCK;
+    buffer->hizHeight = OCCLUSION_HEIGHT / OCCLUSION_HIZ_BLOCK;
+    buffer->viewProjection = viewProjection;
+
+    buffer->depth.assign(buffer->width * buffer->height, 1.0f);
+    buffer->hiz.assign(buffer->hizWidth * buffer->hizHeight, 1.0f);
+    buffer->triangles.clear();
+    buffer->tileBins.resize(buffer->tilesX * buffer->tilesY);
+    for (u32 i = 0; i < buffer->tileBins.size(); ++i)
+        buffer->tileBins[i].clear();
+}
+
+static bool ProjectToScreen(const OcclusionBuffer& buffer, const glm::vec4& clip, glm::vec3* screen)
+{
+    if (clip.w <= 1e-4f)
+        return false;
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    screen->x = (ndc.x * 0.5f + 0.5f) * buffer.width;
+    screen->y = (ndc.y * 0.5f + 0.5f) * buffer.height;
+    screen->z = ndc.z * 0.5f + 0.5f;
+    return true;
+}
+
+void AddOccluder(OcclusionBuffer* buffer, const glm::mat4& transform, const f32* vertices, u32 stride, const u32* indices, u32 indexCount, u32 baseVertex)
+{
+    const glm::mat4 mvp = buffer->viewProjection * transform;
+
+    for (u32 i = 0; i + 2 < indexCount; i += 3)
+    {
+        OcclusionTriangle tri;
+        bool valid = true;
+        for (u32 v = 0; v < 3 && valid; ++v)
+        {
+            const f32* p = vertices + (indices[i + v] + baseVertex) * stride;
+            valid = ProjectToScreen(*buffer, mvp * glm::vec4(p[0], p[1], p[2], 1.0f), &tri.v[v]);
+        }
+
+        // Triangles crossing the near plane are dropped: occluding less is always safe
+        if (!valid)
+            continue;
+
+        f32 minX = glm::min(tri.v[0].x, glm::min(tri.v[1].x, tri.v[2].x));
+        f32 maxX = glm::max(tri.v[0].x, glm::max(tri.v[1].x, tri.v[2].x));
+        f32 minY = glm::min(tri.v[0].y, glm::min(tri.v[1].y, tri.v[2].y));
+        f32 maxY = glm::max(tri.v[0].y, glm::max(tri.v[1].y, tri.v[2].y));
+        if (maxX < 0.0f || maxY < 0.0f || minX >= buffer->width || minY >= buffer->height)
+            continue;
+
+        minX = glm::max(minX, 0.0f); maxX = glm::min(maxX, (f32)buffer->width - 1.0f);
+        minY = glm::max(minY, 0.0f); maxY = glm::min(maxY, (f32)buffer->height - 1.0f);
+
+        u32 triIdx = buffer->triangles.size();
+        buffer->triangles.push_back(tri);
+
+        i32 tileMinX = glm::max((i32)minX / OCCLUSION_TILE_WIDTH, 0);
+        i32 tileMaxX = glm::min((i32)maxX / OCCLUSION_TILE_WIDTH, (i32)buffer->tilesX - 1);
+        i32 tileMinY = glm::max((i32)minY / OCCLUSION_TILE_HEIGHT, 0);
+        i32 tileMaxY = glm::min((i32)maxY / OCCLUSION_TILE_HEIGHT, (i32)buffer->tilesY - 1);
+        for (i32 ty = tileMinY; ty <= tileMaxY; ++ty)
+            for (i32 tx = tileMinX; tx <= tileMaxX; ++tx)
+                buffer->tileBins[ty * buffer->tilesX + tx].push_back(triIdx);
+    }
+}
+
+// Always evaluated from the same endpoint, so the two triangles sharing an edge get exactly
+// opposite values and pixel centers lying on it can't be missed by both
+static void EdgeFunction(const glm::vec3& from, const glm::vec3& to, f32* a, f32* b, f32* c)
+{
+    bool swap = to.x < from.x || (to.x == from.x && to.y < from.y);
+    const glm::vec3& p = swap ? to : from;
+    const glm::vec3& q = swap ? from : to;
+    f32 sign = swap ? -1.0f : 1.0f;
+    f32 pa = p.y - q.y, pb = q.x - p.x;
+    *a = sign * pa;
+    *b = sign * pb;
+    *c = sign * -(pa * p.x + pb * p.y);
+}
+
+static void RasterizeTile(void* data, u32 tileIdx)
+{
+    OcclusionBuffer* buffer = (OcclusionBuffer*)data;
+    const u32 width = buffer->width;
+    const i32 tileMinX = (tileIdx % buffer->tilesX) * OCCLUSION_TILE_WIDTH;
+    const i32 tileMinY = (tileIdx / buffer->tilesX) * OCCLUSION_TILE_HEIGHT;
+    const i32 tileMaxX = tileMinX + OCCLUSION_TILE_WIDTH - 1;
+    const i32 tileMaxY = tileMinY + OCCLUSION_TILE_HEIGHT - 1;
+
+    const std::vector<u32>& bin = buffer->tileBins[tileIdx];
+    const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (u32 t = 0; t < bin.size(); ++t)
+    {
+        glm::vec3 v0 = buffer->triangles[bin[t]].v[0];
+        glm::vec3 v1 = buffer->triangles[bin[t]].v[1];
+        glm::vec3 v2 = buffer->triangles[bin[t]].v[2];
+
+        // Both faces are rasterized, so make the winding counter clockwise
+        f32 area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (area == 0.0f)
+            continue;
+        if (area < 0.0f)
+        {
+            glm::vec3 tmp = v1; v1 = v2; v2 = tmp;
+            area = -area;
+        }
+
+        // Clamped as floats first so huge coordinates don't overflow the conversion
+        i32 minX = (i32)floorf(glm::max(glm::min(v0.x, glm::min(v1.x, v2.x)), (f32)tileMinX)) & ~3;
+        i32 maxX = (i32)ceilf(glm::min(glm::max(v0.x, glm::max(v1.x, v2.x)), (f32)tileMaxX));
+        i32 minY = (i32)floorf(glm::max(glm::min(v0.y, glm::min(v1.y, v2.y)), (f32)tileMinY));
+        i32 maxY = (i32)ceilf(glm::min(glm::max(v0.y, glm::max(v1.y, v2.y)), (f32)tileMaxY));
+
+        // Edge function E(a, b, p) = A * p.x + B * p.y + C, positive inside
+        f32 a0, b0, c0, a1, b1, c1, a2, b2, c2;
+        EdgeFunction(v1, v2, &a0, &b0, &c0);
+        EdgeFunction(v2, v0, &a1, &b1, &c1);
+        EdgeFunction(v0, v1, &a2, &b2, &c2);
+
+        // Depth is affine in screen space: z = w0 * z0 + w1 * z1 + w2 * z2 with normalized weights
+        f32 invArea = 1.0f / area;
+        __m128 z0 = _mm_set1_ps(v0.z * invArea);
+        __m128 z1 = _mm_set1_ps(v1.z * invArea);
+        __m128 z2 = _mm_set1_ps(v2.z * invArea);
+
+        __m128 A0 = _mm_set1_ps(a0), A1 = _mm_set1_ps(a1), A2 = _mm_set1_ps(a2);
+        __m128 step0 = _mm_set1_ps(4.0f * a0), step1 = _mm_set1_ps(4.0f * a1), step2 = _mm_set1_ps(4.0f * a2);
+
+        for (i32 y = minY; y <= maxY; ++y)
+        {
+            f32 py = (f32)y + 0.5f;
+            __m128 px = _mm_add_ps(_mm_set1_ps((f32)minX), pixelOffsets);
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(A0, px), _mm_set1_ps(b0 * py + c0));
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(A1, px), _mm_set1_ps(b1 * py + c1));
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(A2, px), _mm_set1_ps(b2 * py + c2));
+
+            f32* row = &buffer->depth[y * width];
+            for (i32 x = minX; x <= maxX; x += 4)
+            {
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)), _mm_cmpge_ps(w2, zero));
+                if (_mm_movemask_ps(inside))
+                {
+                    __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, z0), _mm_mul_ps(w1, z1)), _mm_mul_ps(w2, z2));
+                    __m128 old = _mm_loadu_ps(row + x);
+                    __m128 closer = _mm_min_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+                }
+                w0 = _mm_add_ps(w0, step0);
+                w1 = _mm_add_ps(w1, step1);
+                w2 = _mm_add_ps(w2, step2);
+            }
+        }
+    }
+
+    // Reduce the tile into the hierarchical buffer keeping the farthest depth of each block
+    for (i32 by = tileMinY; by <= tileMaxY; by += OCCLUSION_HIZ_BLOCK)
+    {
+        for (i32 bx = tileMinX; bx <= tileMaxX; bx += OCCLUSION_HIZ_BLOCK)
+        {
+            __m128 blockMax = zero;
+            for (i32 y = by; y < by + OCCLUSION_HIZ_BLOCK; ++y)
+                for (i32 x = bx; x < bx + OCCLUSION_HIZ_BLOCK; x += 4)
+                    blockMax = _mm_max_ps(blockMax, _mm_loadu_ps(&buffer->depth[y * width + x]));
+
+            blockMax = _mm_max_ps(blockMax, _mm_shuffle_ps(blockMax, blockMax, _MM_SHUFFLE(1, 0, 3, 2)));
+            blockMax = _mm_max_ps(blockMax, _mm_shuffle_ps(blockMax, blockMax, _MM_SHUFFLE(2, 3, 0, 1)));
+            buffer->hiz[(by / OCCLUSION_HIZ_BLOCK) * buffer->hizWidth + bx / OCCLUSION_HIZ_BLOCK] = _mm_cvtss_f32(blockMax);
+        }
+    }
+}
+
+void RasterizeOccluders(OcclusionBuffer* buffer)
+{
+    ParallelFor(buffer->tilesX * buffer->tilesY, RasterizeTile, buffer);
+}
+
+bool IsAABBVisible(const OcclusionBuffer& buffer, const AABB& aabb)
+{
+    f32 minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    f32 minZ = FLT_MAX;
+
+    for (u32 i = 0; i < 8; ++i)
+    {
+        glm::vec4 corner = glm::vec4((i & 1) ? aabb.max.x : aabb.min.x,
+                                     (i & 2) ? aabb.max.y : aabb.min.y,
+                                     (i & 4) ? aabb.max.z : aabb.min.z, 1.0f);
+        glm::vec3 screen;
+        if (!ProjectToScreen(buffer, buffer.viewProjection * corner, &screen))
+            return true; // Crosses the near plane, the camera is (almost) inside
+
+        minX = glm::min(minX, screen.x); maxX = glm::max(maxX, screen.x);
+        minY = glm::min(minY, screen.y); maxY = glm::max(maxY, screen.y);
+        minZ = glm::min(minZ, screen.z);
+    }
+
+    if (maxX < 0.0f || maxY < 0.0f || minX >= buffer.width || minY >= buffer.height)
+        return true; // Off screen, the frustum test is in charge of these
+
+    minX = glm::max(minX, 0.0f); maxX = glm::min(maxX, (f32)buffer.width - 1.0f);
+    minY = glm::max(minY, 0.0f); maxY = glm::min(maxY, (f32)buffer.height - 1.0f);
+
+    i32 blockMinX = glm::max((i32)floorf(minX) / OCCLUSION_HIZ_BLOCK, 0);
+    i32 blockMaxX = glm::min((i32)ceilf(maxX) / OCCLUSION_HIZ_BLOCK, (i32)buffer.hizWidth - 1);
+    i32 blockMinY = glm::max((i32)floorf(minY) / OCCLUSION_HIZ_BLOCK, 0);
+    i32 blockMaxY = glm::min((i32)ceilf(maxY) / OCCLUSION_HIZ_BLOCK, (i32)buffer.hizHeight - 1);
+
+    // Hidden only if its nearest point is behind the farthest occluder of every block it covers
+    for (i32 by = blockMinY; by <= blockMaxY; ++by)
+        for (i32 bx = blockMinX; bx <= blockMaxX; ++bx)
+            if (minZ <= buffer.hiz[by * buffer.hizWidth + bx])
+                return true;
+
+    return false;
+}
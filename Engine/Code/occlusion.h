@@ -0,0 +1,55 @@
+//
+// occlusion.h: This file contains the CPU software occlusion culling: a low resolution depth
+// buffer where the occluder triangles are rasterized (SIMD, tiled, one job per tile), a
+// hierarchical max depth buffer built from it, and the test of object bounds against it.
+// Doesn't touch OpenGL at all, so it can run headless.
+//
+
+#pragma once
+
+#include "culling.h"
+
+#define OCCLUSION_WIDTH        320
+#define OCCLUSION_HEIGHT       192
+#define OCCLUSION_TILE_WIDTH   64
+#define OCCLUSION_TILE_HEIGHT  32
+#define OCCLUSION_HIZ_BLOCK    8
+
+struct OcclusionTriangle
+{
+    // Screen space x, y (pixels) and depth in [0, 1]
+    glm::vec3 v[3];
+};
+
+struct OcclusionBuffer
+{
+    u32 width = 0, height = 0;
+    u32 tilesX = 0, tilesY = 0;
+    glm::mat4 viewProjection;
+
+    // Closest occluder depth per pixel, cleared to the far plane (1.0)
+    std::vector<f32> depth;
+
+    // Farthest depth of every OCCLUSION_HIZ_BLOCK^2 block of pixels
+    u32 hizWidth = 0, hizHeight = 0;
+    std::vector<f32> hiz;
+
+    std::vector<OcclusionTriangle> triangles;
+    std::vector<std::vector<u32>>  tileBins;
+};
+
+/** Prepares the buffer for a new frame with the given camera. */
+void ClearOcclusionBuffer(OcclusionBuffer* buffer, const glm::mat4& viewProjection);
+
+/**
+ * Transforms an indexed triangle list with the object transform and bins its triangles into
+ * the screen tiles. Positions are the first three floats of every vertex, stride is in floats
+ * and baseVertex is added to every index.
+ */
+void AddOccluder(OcclusionBuffer* buffer, const glm::mat4& transform, const f32* vertices, u32 stride, const u32* indices, u32 indexCount, u32 baseVertex = 0);
+
+/** Rasterizes all the binned occluders (in parallel, one job per tile) and builds the hierarchical depth. */
+void RasterizeOccluders(OcclusionBuffer* buffer);
+
+/** Returns false only if the box is completely hidden behind the rasterized occluders. */
+bool IsAABBVisible(const OcclusionBuffer& buffer, const AABB& aabb);
@@ -0,0 +1,73 @@
+//
+// occlusion_check.cpp : Headless check of the software occlusion culling, opt-in with
+// OCCLUSION_CHECK (empty in the engine build). It rasterizes a known occluder quad and checks
+// which boxes are reported hidden. Built without OpenGL nor the platform layer, e.g.
+//   g++ -std=c++17 -msse4.1 -DOCCLUSION_CHECK -IThirdParty/glm/include Code/occlusion_check.cpp
+//       Code/occlusion.cpp Code/culling.cpp Code/jobs.cpp -pthread -o occlusion_check
+// Returns 0 if every check passed.
+//
+
+#ifdef OCCLUSION_CHECK
+
+#include "occlusion.h"
+#include "jobs.h"
+
+// The platform layer isn't linked, the job system logs through this
+void LogString(const char* str)
+{
+    printf("%s\n", str);
+}
+
+static u32 FailedChecks = 0;
+
+static void Check(bool condition, const char* description)
+{
+    printf("%s: %s\n", condition ? "PASS" : "FAIL", description);
+    if (!condition)
+        FailedChecks++;
+}
+
+static AABB MakeBox(const glm::vec3& center, f32 halfSize)
+{
+    AABB aabb;
+    aabb.min = center - glm::vec3(halfSize);
+    aabb.max = center + glm::vec3(halfSize);
+    return aabb;
+}
+
+int main()
+{
+    InitJobSystem();
+
+    // Camera at the origin looking down -Z
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), (f32)OCCLUSION_WIDTH / OCCLUSION_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    OcclusionBuffer buffer;
+    ClearOcclusionBuffer(&buffer, projection * view);
+    Check(IsAABBVisible(buffer, MakeBox(glm::vec3(0.0f, 0.0f, -10.0f), 0.5f)), "box visible before any occluder");
+
+    // 6x6 quad facing the camera at z = -5, its shadow at z = -10 spans [-6, 6]
+    const f32 quad[] = {
+        -3.0f, -3.0f, -5.0f,
+         3.0f, -3.0f, -5.0f,
+         3.0f,  3.0f, -5.0f,
+        -3.0f,  3.0f, -5.0f,
+    };
+    const u32 indices[] = { 0, 1, 2, 0, 2, 3 };
+    AddOccluder(&buffer, glm::mat4(1.0f), quad, 3, indices, ARRAY_COUNT(indices));
+    RasterizeOccluders(&buffer);
+
+    Check(!IsAABBVisible(buffer, MakeBox(glm::vec3(0.0f, 0.0f, -10.0f), 0.5f)), "box behind the quad is occluded");
+    Check(!IsAABBVisible(buffer, MakeBox(glm::vec3(-3.0f, 3.0f, -20.0f), 1.0f)), "far box inside the shadow is occluded");
+    Check(IsAABBVisible(buffer, MakeBox(glm::vec3(8.0f, 0.0f, -10.0f), 0.5f)), "box beside the quad is visible");
+    Check(IsAABBVisible(buffer, MakeBox(glm::vec3(5.5f, 0.0f, -10.0f), 1.0f)), "box straddling the shadow edge is visible");
+    Check(IsAABBVisible(buffer, MakeBox(glm::vec3(0.0f, 0.0f, -2.0f), 0.5f)), "box in front of the quad is visible");
+
+    ShutdownJobSystem();
+
+    printf("%u check(s) failed\n", FailedChecks);
+    return FailedChecks == 0 ? 0 : 1;
+}
+
+#endif // OCCLUSION_CHECK
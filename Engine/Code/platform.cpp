@@ -114,13 +114,19 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+int main(int argc, char** argv)
 {
     App app         = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
     app.isRunning   = true;
 
+    if (!ParseSceneArguments(&app.sceneParams, argc, argv))
+    {
+        ELOG("usage: Engine [-objects N] [-lights M] [-seed S] [-layout grid|random] [-spacing X] [-extent X] [-occluders R]\n");
+        return -1;
+    }
+
 		glfwSetErrorCallback(OnGlfwError);
 
     if (!glfwInit())
@@ -160,6 +166,14 @@ int main()
         return -1;
     }
 
+    // Entry points beyond the 4.3 profile loaded by glad
+    if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 6))
+        app.glExt.multiDrawElementsIndirectCount = (PFNMULTIDRAWELEMENTSINDIRECTCOUNTPROC)glfwGetProcAddress("glMultiDrawElementsIndirectCount");
+    else if (glfwExtensionSupported("GL_ARB_indirect_parameters"))
+        app.glExt.multiDrawElementsIndirectCount = (PFNMULTIDRAWELEMENTSINDIRECTCOUNTPROC)glfwGetProcAddress("glMultiDrawElementsIndirectCountARB");
+    if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4) || glfwExtensionSupported("GL_ARB_buffer_storage"))
+        app.glExt.bufferStorage = (PFNBUFFERSTORAGEPROC)glfwGetProcAddress("glBufferStorage");
+
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -199,6 +213,8 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    InitJobSystem();
+
     Init(&app);
 
     while (app.isRunning)
@@ -264,6 +280,8 @@ int main()
 
     free(GlobalFrameArenaMemory);
 
+    ShutdownJobSystem();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
 
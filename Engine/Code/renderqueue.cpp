@@ -0,0 +1,76 @@
+//
+// renderqueue.cpp : Sort key packing and the radix sort of the render packets.
+//
+
+#include "renderqueue.h"
+
+u64 MakeSortKey(u32 pass, u32 programIdx, u32 materialIdx, u32 meshIdx, u32 submeshIdx, f32 depth)
+{
+    // Packets with equal state keys are drawn together, the indices must not be truncated
+    ASSERT(materialIdx < (1u << SORT_KEY_MATERIAL_BITS) && meshIdx < (1u << SORT_KEY_MESH_BITS) &&
+           submeshIdx < (1u << SORT_KEY_SUBMESH_BITS), "Sort key field overflow");
+
+    u32 maxDepth = (1u << SORT_KEY_DEPTH_BITS) - 1;
+    u32 quantizedDepth = (u32)(glm::clamp(depth, 0.0f, 1.0f) * maxDepth);
+
+    u64 key = 0;
+    key |= (u64)(pass        & ((1u << SORT_KEY_PASS_BITS) - 1))     << SORT_KEY_PASS_SHIFT;
+    key |= (u64)(programIdx  & ((1u << SORT_KEY_PROGRAM_BITS) - 1))  << SORT_KEY_PROGRAM_SHIFT;
+    key |= (u64)(materialIdx & ((1u << SORT_KEY_MATERIAL_BITS) - 1)) << SORT_KEY_MATERIAL_SHIFT;
+    key |= (u64)(meshIdx     & ((1u << SORT_KEY_MESH_BITS) - 1))     << SORT_KEY_MESH_SHIFT;
+    key |= (u64)(submeshIdx  & ((1u << SORT_KEY_SUBMESH_BITS) - 1))  << SORT_KEY_SUBMESH_SHIFT;
+    key |= (u64)quantizedDepth << SORT_KEY_DEPTH_SHIFT;
+    return key;
+}
+
+void ClearRenderQueue(RenderQueue* queue)
+{
+    queue->packets.clear();
+}
+
+void SortRenderQueue(RenderQueue* queue)
+{
+    u32 count = queue->packets.size();
+    if (count < 2)
+        return;
+
+    // All the histograms in a single read of the keys
+    u32 histograms[8][256] = {};
+    for (u32 i = 0; i < count; ++i)
+    {
+        u64 key = queue->packets[i].key;
+        for (u32 b = 0; b < 8; ++b)
+            histograms[b][(key >> (b * 8)) & 0xFF]++;
+    }
+
+    queue->scratch.resize(count);
+    RenderPacket* src = queue->packets.data();
+    RenderPacket* dst = queue->scratch.data();
+
+    for (u32 b = 0; b < 8; ++b)
+    {
+        u32* histogram = histograms[b];
+        u32 firstByte = (src[0].key >> (b * 8)) & 0xFF;
+        if (histogram[firstByte] == count)
+            continue;
+
+        u32 offsets[256];
+        u32 sum = 0;
+        for (u32 d = 0; d < 256; ++d)
+        {
+            offsets[d] = sum;
+            sum += histogram[d];
+        }
+
+        for (u32 i = 0; i < count; ++i)
+            dst[offsets[(src[i].key >> (b * 8)) & 0xFF]++] = src[i];
+
+        RenderPacket* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    // An odd number of passes leaves the result in the scratch buffer
+    if (src != queue->packets.data())
+        queue->packets.swap(queue->scratch);
+}
@@ -0,0 +1,70 @@
+//
+// renderqueue.h: This file contains the render queue: every frame the visible draws are
+// emitted as packets with a 64 bit sort key, radix sorted, and submitted in key order so
+// the GL state only changes where the key does.
+//
+
+#pragma once
+
+#include "platform.h"
+
+// Key layout, most significant bits first. Sorting the keys orders the packets by pass, then
+// by the state they need (program, material, vertex array), and front to back inside a draw.
+//   pass     [63, 60]
+//   program  [59, 52]
+//   material [51, 40]
+//   mesh     [39, 28]  (vertex array)
+//   submesh  [27, 16]
+//   depth    [15,  0]  (quantized view depth, closest first)
+#define SORT_KEY_PASS_BITS     4
+#define SORT_KEY_PROGRAM_BITS  8
+#define SORT_KEY_MATERIAL_BITS 12
+#define SORT_KEY_MESH_BITS     12
+#define SORT_KEY_SUBMESH_BITS  12
+#define SORT_KEY_DEPTH_BITS    16
+
+#define SORT_KEY_DEPTH_SHIFT    0
+#define SORT_KEY_SUBMESH_SHIFT  (SORT_KEY_DEPTH_SHIFT + SORT_KEY_DEPTH_BITS)
+#define SORT_KEY_MESH_SHIFT     (SORT_KEY_SUBMESH_SHIFT + SORT_KEY_SUBMESH_BITS)
+#define SORT_KEY_MATERIAL_SHIFT (SORT_KEY_MESH_SHIFT + SORT_KEY_MESH_BITS)
+#define SORT_KEY_PROGRAM_SHIFT  (SORT_KEY_MATERIAL_SHIFT + SORT_KEY_MATERIAL_BITS)
+#define SORT_KEY_PASS_SHIFT     (SORT_KEY_PROGRAM_SHIFT + SORT_KEY_PROGRAM_BITS)
+
+// Everything above the depth: packets with the same state key can share a draw
+#define SORT_KEY_STATE_MASK     (~0ull << SORT_KEY_SUBMESH_SHIFT)
+
+enum RenderPass
+{
+    RenderPass_Geometry,
+    RenderPass_Count
+};
+
+struct RenderPacket
+{
+    u64 key;
+    u32 objectIdx;
+    u32 submeshIdx;
+};
+
+struct RenderQueue
+{
+    std::vector<RenderPacket> packets;
+    std::vector<RenderPacket> scratch; // Ping-pong buffer of the radix sort
+};
+
+/** Packs the fields into a sort key, the indices must fit their bit count. depth is in [0, 1], closest first. */
+u64 MakeSortKey(u32 pass, u32 programIdx, u32 materialIdx, u32 meshIdx, u32 submeshIdx, f32 depth);
+
+void ClearRenderQueue(RenderQueue* queue);
+
+inline void PushRenderPacket(RenderQueue* queue, u64 key, u32 objectIdx, u32 submeshIdx)
+{
+    RenderPacket packet = { key, objectIdx, submeshIdx };
+    queue->packets.push_back(packet);
+}
+
+/**
+ * Stable LSD radix sort of the packets by key, one byte per pass. Passes where every key
+ * has the same byte are skipped, so the unused high fields cost nothing.
+ */
+void SortRenderQueue(RenderQueue* queue);
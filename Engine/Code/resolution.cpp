@@ -0,0 +1,53 @@
+//
+// resolution.cpp : Dynamic resolution controller.
+//
+
+#include "resolution.h"
+
+bool UpdateDynamicResolution(DynamicResolution* resolution, f32 gpuFrameMs, u32 latencyFrames)
+{
+    if (!resolution->enabled || gpuFrameMs <= 0.0f)
+        return false;
+
+    if (resolution->settleSamples > 0)
+    {
+        resolution->settleSamples--;
+        return false;
+    }
+
+    resolution->history[resolution->historyHead] = gpuFrameMs;
+    resolution->historyHead = (resolution->historyHead + 1) % DYNAMIC_RESOLUTION_HISTORY;
+    resolution->historyCount = glm::min(resolution->historyCount + 1, (u32)DYNAMIC_RESOLUTION_HISTORY);
+    if (resolution->historyCount < DYNAMIC_RESOLUTION_HISTORY / 2)
+        return false;
+
+    f32 averageMs = 0.0f;
+    for (u32 i = 0; i < resolution->historyCount; ++i)
+        averageMs += resolution->history[i];
+    averageMs /= resolution->historyCount;
+
+    // The cost of the deferred passes follows the pixel count
+    f32 scale = resolution->scale;
+    f32 desired = scale * glm::sqrt(resolution->targetMs / averageMs);
+    if (averageMs > resolution->targetMs)
+        scale = desired;
+    else if (averageMs < 0.9f * resolution->targetMs)
+        scale += 0.5f * (desired - scale);
+
+    scale = glm::clamp(scale, resolution->minScale, resolution->maxScale);
+    scale = glm::round(scale * DYNAMIC_RESOLUTION_STEPS) / DYNAMIC_RESOLUTION_STEPS;
+    scale = glm::clamp(scale, resolution->minScale, resolution->maxScale);
+    if (scale == resolution->scale)
+        return false;
+
+    resolution->scale = scale;
+    resolution->historyCount = 0;
+    resolution->historyHead = 0;
+    resolution->settleSamples = latencyFrames;
+    return true;
+}
+
+u32 ScaledResolution(const DynamicResolution& resolution, u32 size)
+{
+    return glm::max((u32)glm::round(size * resolution.scale), 1u);
+}
@@ -0,0 +1,40 @@
+//
+// resolution.h: This file contains the dynamic resolution controller: it watches the GPU
+// frame time and picks the fraction of the render targets the frame is rendered at, so the
+// frame time holds a target on slower hardware.
+//
+
+#pragma once
+
+#include "platform.h"
+
+// GPU frame times the estimate is averaged over
+#define DYNAMIC_RESOLUTION_HISTORY 8
+
+// Scales are multiples of 1/DYNAMIC_RESOLUTION_STEPS, small changes don't move the viewport every frame
+#define DYNAMIC_RESOLUTION_STEPS 32
+
+struct DynamicResolution
+{
+    bool enabled = false;
+    f32  targetMs = 16.0f;
+    f32  minScale = 0.5f;
+    f32  maxScale = 1.0f;
+    f32  scale = 1.0f;  // Of both sides of the render targets
+
+    f32 history[DYNAMIC_RESOLUTION_HISTORY];
+    u32 historyCount = 0;
+    u32 historyHead = 0;
+    u32 settleSamples = 0; // Samples still in flight at the previous scale, ignored
+};
+
+/**
+ * Feeds the GPU time of a finished frame. Once the history is half full, the scale moves so
+ * the pixel count (scale^2) follows targetMs / average time: down right away when over
+ * budget, up halfway when under 90% of it. latencyFrames samples are skipped after a change.
+ * Returns true if the scale changed.
+ */
+bool UpdateDynamicResolution(DynamicResolution* resolution, f32 gpuFrameMs, u32 latencyFrames);
+
+/** Side length of the rendered area for a target side, at least one pixel. */
+u32 ScaledResolution(const DynamicResolution& resolution, u32 size);
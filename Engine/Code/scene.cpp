@@ -0,0 +1,218 @@
+//
+// scene.cpp : Procedural stress scene generation. Everything depends only on the parameters
+// and the seed, so two runs with the same command line give exactly the same workload.
+//
+
+#include "scene.h"
+#include "engine.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <float.h>
+#include <stdint.h>
+
+void SeedRandom(SceneRandom* rng, u32 seed)
+{
+    // splitmix64 to spread the bits of small seeds
+    u64 z = (u64)seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    rng->state = (z ^ (z >> 31)) | 1ull;
+}
+
+u32 NextRandom(SceneRandom* rng)
+{
+    // xorshift64*
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return (u32)((rng->state * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+f32 RandomRange(SceneRandom* rng, f32 min, f32 max)
+{
+    f32 t = (NextRandom(rng) >> 8) * (1.0f / 16777216.0f);
+    return min + (max - min) * t;
+}
+
+static const char* SceneArguments[] = { "-objects", "-lights", "-seed", "-layout", "-spacing", "-extent", "-occluders" };
+
+static bool IsSceneArgument(const char* arg)
+{
+    for (u32 i = 0; i < ARRAY_COUNT(SceneArguments); ++i)
+        if (strcmp(arg, SceneArguments[i]) == 0)
+            return true;
+    return false;
+}
+
+// The whole value has to be a number in [min, max], "10k" is rejected rather than read as 10
+static bool ParseInteger(const char* arg, const char* value, i64 min, i64 max, i64* result)
+{
+    char* end;
+    errno = 0;
+    long long number = strtoll(value, &end, 10);
+    if (end == value || *end != '\0' || errno == ERANGE || number < min || number > max)
+    {
+        ELOG("Invalid value %s for command line argument %s, expected an integer in [%lld, %lld]", value, arg, (long long)min, (long long)max);
+        return false;
+    }
+    *result = number;
+    return true;
+}
+
+static bool ParseFloat(const char* arg, const char* value, f32 min, f32 max, f32* result)
+{
+    char* end;
+    errno = 0;
+    f32 number = strtof(value, &end);
+    if (end == value || *end != '\0' || errno == ERANGE || !(number >= min && number <= max))
+    {
+        ELOG("Invalid value %s for command line argument %s, expected a number in [%g, %g]", value, arg, min, max);
+        return false;
+    }
+    *result = number;
+    return true;
+}
+
+bool ParseSceneArguments(SceneGeneratorParams* params, int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (!IsSceneArgument(arg))
+        {
+            ELOG("Unknown command line argument %s", arg);
+            return false;
+        }
+
+        if (!value)
+        {
+            ELOG("Missing value for command line argument %s", arg);
+            return false;
+        }
+
+        i64 integer = 0;
+        bool valid = true;
+        if (strcmp(arg, "-objects") == 0)
+        {
+            valid = ParseInteger(arg, value, 0, INT32_MAX, &integer);
+            params->objectCount = (i32)integer;
+        }
+        else if (strcmp(arg, "-lights") == 0)
+        {
+            valid = ParseInteger(arg, value, 0, INT32_MAX, &integer);
+            params->lightCount = (i32)integer;
+        }
+        else if (strcmp(arg, "-seed") == 0)
+        {
+            valid = ParseInteger(arg, value, 0, UINT32_MAX, &integer);
+            params->seed = (u32)integer;
+        }
+        else if (strcmp(arg, "-spacing") == 0)   valid = ParseFloat(arg, value, 0.001f, FLT_MAX, &params->spacing);
+        else if (strcmp(arg, "-extent") == 0)    valid = ParseFloat(arg, value, 0.001f, FLT_MAX, &params->extent);
+        else if (strcmp(arg, "-occluders") == 0) valid = ParseFloat(arg, value, 0.0f, 1.0f, &params->occluderRatio);
+        else // -layout
+        {
+            if      (strcmp(value, "grid") == 0)   params->layout = SceneLayout_Grid;
+            else if (strcmp(value, "random") == 0) params->layout = SceneLayout_Random;
+            else
+            {
+                ELOG("Unknown scene layout %s", value);
+                valid = false;
+            }
+        }
+
+        if (!valid)
+            return false;
+
+        params->enabled = true;
+        ++i;
+    }
+
+    return true;
+}
+
+void GenerateScene(App* app, const SceneGeneratorParams& params, u32 modelIdx)
+{
+    SceneRandom rng;
+    SeedRandom(&rng, params.seed);
+
+    app->modelSceneObjects.clear();
+    app->lightSceneObjects.clear();
+    app->sceneBVHDirty = true;
+    app->selectedObject = -1;
+    app->modelSceneObjects.reserve(params.objectCount);
+    app->lightSceneObjects.reserve(params.lightCount);
+
+    // Half size of the area covered by the objects, the lights are spread over the same area.
+    // A grid of less than two objects per side covers no area, it keeps the configured extent
+    f32 halfSize = params.extent;
+    u32 gridSide = (u32)ceilf(sqrtf((f32)params.objectCount));
+    f32 gridHalfSize = 0.5f * (f32)(gridSide > 0 ? gridSide - 1 : 0) * params.spacing;
+    if (params.layout == SceneLayout_Grid && gridSide > 1)
+        halfSize = gridHalfSize;
+
+    if (modelIdx != UINT32_MAX)
+    {
+        for (i32 i = 0; i < params.objectCount; ++i)
+        {
+            vec3 position;
+            if (params.layout == SceneLayout_Grid)
+            {
+                position.x = (f32)(i % gridSide) * params.spacing - gridHalfSize;
+                position.y = 0.0f;
+                position.z = (f32)(i / gridSide) * params.spacing - gridHalfSize;
+            }
+            else
+            {
+                position.x = RandomRange(&rng, -halfSize, halfSize);
+                position.y = 0.0f;
+                position.z = RandomRange(&rng, -halfSize, halfSize);
+            }
+
+            f32 angle = RandomRange(&rng, 0.0f, TAU);
+
+            ModelSceneObject sobj = {};
+            sobj.modelIdx = modelIdx;
+            sobj.transform = glm::translate(glm::mat4(1.0f), position) * glm::rotate(angle, vec3(0.0f, 1.0f, 0.0f));
+            sobj.isOccluder = RandomRange(&rng, 0.0f, 1.0f) < params.occluderRatio;
+            app->modelSceneObjects.push_back(sobj);
+        }
+    }
+
+    for (i32 i = 0; i < params.lightCount; ++i)
+    {
+        LightSceneObject lsObj = {};
+        lsObj.position = vec3(RandomRange(&rng, -halfSize, halfSize),
+                              RandomRange(&rng, 0.5f, 5.0f),
+                              RandomRange(&rng, -halfSize, halfSize));
+
+        bool isSpot = RandomRange(&rng, 0.0f, 1.0f) < params.spotLightRatio;
+        lsObj.light.type = isSpot ? L_SPOTLIGHT : L_POINT;
+
+        // Aim spot lights downwards with some random tilt
+        vec3 dir = vec3(RandomRange(&rng, -0.5f, 0.5f), -1.0f, RandomRange(&rng, -0.5f, 0.5f));
+        lsObj.direction = glm::normalize(dir);
+
+        // Attenuation that fades out around the chosen radius
+        f32 radius = RandomRange(&rng, params.minLightRadius, params.maxLightRadius);
+        lsObj.light.intensity = 1.0f;
+        lsObj.light.constant = 1.0f;
+        lsObj.light.linear = 4.5f / radius;
+        lsObj.light.quadratic = 75.0f / (radius * radius);
+
+        lsObj.light.diffuse = vec3(RandomRange(&rng, 0.2f, 1.0f), RandomRange(&rng, 0.2f, 1.0f), RandomRange(&rng, 0.2f, 1.0f));
+        lsObj.light.specular = 0.2f;
+
+        lsObj.light.cutOff[0] = RandomRange(&rng, 10.0f, 25.0f);
+        lsObj.light.outerCutOff[0] = lsObj.light.cutOff[0] + 5.0f;
+        lsObj.light.cutOff[1] = glm::cos(glm::radians(lsObj.light.cutOff[0]));
+        lsObj.light.outerCutOff[1] = glm::cos(glm::radians(lsObj.light.outerCutOff[0]));
+
+        app->lightSceneObjects.push_back(lsObj);
+    }
+
+    ILOG("Generated scene with %d objects and %d lights (seed %u)", params.objectCount, params.lightCount, params.seed);
+}
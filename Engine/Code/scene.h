@@ -0,0 +1,64 @@
+//
+// scene.h: This file contains the procedural scene generator used to build reproducible
+// stress workloads (lots of model instances and lights) for profiling the renderer.
+//
+
+#pragma once
+
+#include "platform.h"
+
+struct App;
+
+enum SceneLayout
+{
+    SceneLayout_Grid,
+    SceneLayout_Random,
+    SceneLayout_Count
+};
+
+struct SceneGeneratorParams
+{
+    bool        enabled = false;
+    SceneLayout layout = SceneLayout_Grid;
+    i32         objectCount = 1000;
+    i32         lightCount = 1000;
+    u32         seed = 1234;
+
+    // Distance between grid cells, or half size of the box used by the random layout
+    f32         spacing = 3.0f;
+    f32         extent = 50.0f;
+
+    // Light radius range and the fraction of the lights that will be spot lights
+    f32         minLightRadius = 1.0f;
+    f32         maxLightRadius = 6.0f;
+    f32         spotLightRatio = 0.25f;
+
+    // Fraction of the objects rasterized as occluders by the software occlusion culling
+    f32         occluderRatio = 0.0f;
+};
+
+// Small deterministic generator so the same seed gives the same scene on every platform
+struct SceneRandom
+{
+    u64 state;
+};
+
+void SeedRandom(SceneRandom* rng, u32 seed);
+
+u32 NextRandom(SceneRandom* rng);
+
+f32 RandomRange(SceneRandom* rng, f32 min, f32 max);
+
+/**
+ * Parses the stress scene options from the command line into params. Recognized options:
+ *   -objects N  -lights M  -seed S  -layout grid|random  -spacing X  -extent X  -occluders R
+ * Any of them enables the generator. Returns false if some argument is unknown, malformed or out
+ * of range, e.g. "-objects 10k".
+ */
+bool ParseSceneArguments(SceneGeneratorParams* params, int argc, char** argv);
+
+/**
+ * Clears the current model and light scene objects and fills the scene with
+ * params.objectCount instances of modelIdx and params.lightCount point/spot lights.
+ */
+void GenerateScene(App* app, const SceneGeneratorParams& params, u32 modelIdx);
@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef GPU_CULLING
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+layout(local_size_x = 64) in;
+
+// Must match GPUDrawRecord in engine.h
+struct DrawRecord
+{
+	vec4 aabbMin;
+	vec4 aabbMax;
+	uint objectIndex;
+	uint group;
+	uint indexCount;
+	uint firstIndex;
+	int  baseVertex;
+	uint materialIdx;
+	uint pad0;
+	uint pad1;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int  baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer DrawRecords { DrawRecord draws[]; };
+layout(std430, binding = 2) writeonly buffer DrawCommands { DrawCommand commands[]; };
+layout(std430, binding = 3) buffer DrawCounters { uint counters[]; };
+layout(std430, binding = 4) readonly buffer GroupBases { uint groupBase[]; };
+layout(std430, binding = 5) buffer DrawVisibility { uint visibility[]; };
+
+// Read back by the engine. ALL and LATE count every counter. EARLY only counts its draws, so
+// drawnCount ends up as the early draws plus the ones LATE finds newly visible. VISIBLE
+// counts nothing, its draws were already counted
+layout(std430, binding = 7) buffer CullStats
+{
+	uint drawnCount;
+	uint culledCount;
+	uint occludedCount;
+};
+
+// Must match the CULL_PASS_ values in engine.cpp
+#define CULL_PASS_ALL   0 // Frustum only, every visible draw is emitted
+#define CULL_PASS_EARLY 1 // Draws that were visible last frame, before building the Hi-Z
+#define CULL_PASS_LATE  2 // Tests the Hi-Z and emits the draws that just became visible
+#define CULL_PASS_VISIBLE 3 // Emits every draw the late pass found visible, to draw them again
+
+uniform int pass;
+uniform uint drawCount;
+uniform vec4 frustumPlanes[6];
+
+// Hierarchical depth (max reduction) built from the early pass depth
+uniform sampler2D hiZ;
+uniform vec2 hiZSize;
+uniform vec2 hiZUVScale; // The depth only covers this part of the Hi-Z (dynamic resolution)
+uniform int hiZLevels;
+uniform mat4 viewProjection;
+
+bool isOutsideFrustum(vec3 center, vec3 extent)
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		vec4 plane = frustumPlanes[i];
+		if (dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) < 0.0)
+			return true;
+	}
+	return false;
+}
+
+bool isOccluded(vec3 bmin, vec3 bmax)
+{
+	vec2 uvMin = vec2(1.0);
+	vec2 uvMax = vec2(0.0);
+	float zMin = 1.0;
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = vec3((i & 1) != 0 ? bmax.x : bmin.x, (i & 2) != 0 ? bmax.y : bmin.y, (i & 4) != 0 ? bmax.z : bmin.z);
+		vec4 clip = viewProjection * vec4(corner, 1.0);
+		if (clip.w <= 0.0)
+			return false; // crosses the near plane
+		vec3 ndc = clip.xyz / clip.w;
+		uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+		uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+		zMin = min(zMin, ndc.z * 0.5 + 0.5);
+	}
+	uvMin = clamp(uvMin, vec2(0.0), vec2(1.0)) * hiZUVScale;
+	uvMax = clamp(uvMax, vec2(0.0), vec2(1.0)) * hiZUVScale;
+
+	// Pick the level where the rectangle covers at most 2x2 texels
+	vec2 size = (uvMax - uvMin) * hiZSize;
+	float level = clamp(ceil(log2(max(max(size.x, size.y), 1.0))), 0.0, float(hiZLevels - 1));
+
+	float d = max(max(textureLod(hiZ, uvMin, level).r, textureLod(hiZ, vec2(uvMax.x, uvMin.y), level).r),
+	              max(textureLod(hiZ, vec2(uvMin.x, uvMax.y), level).r, textureLod(hiZ, uvMax, level).r));
+	return zMin > d;
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= drawCount)
+		return;
+
+	DrawRecord draw = draws[i];
+	vec3 center = 0.5 * (draw.aabbMax.xyz + draw.aabbMin.xyz);
+	vec3 extent = 0.5 * (draw.aabbMax.xyz - draw.aabbMin.xyz);
+
+	if (isOutsideFrustum(center, extent))
+	{
+		if (pass == CULL_PASS_LATE)
+			visibility[i] = 0u;
+		if (pass == CULL_PASS_ALL || pass == CULL_PASS_LATE)
+			atomicAdd(culledCount, 1u);
+		return;
+	}
+
+	if ((pass == CULL_PASS_EARLY || pass == CULL_PASS_VISIBLE) && visibility[i] == 0u)
+		return;
+
+	if (pass == CULL_PASS_LATE)
+	{
+		bool visible = !isOccluded(draw.aabbMin.xyz, draw.aabbMax.xyz);
+		bool drawnEarly = visibility[i] != 0u;
+		visibility[i] = visible ? 1u : 0u;
+		if (!visible && !drawnEarly)
+			atomicAdd(occludedCount, 1u);
+		if (!visible || drawnEarly)
+			return;
+	}
+
+	// Compact the visible draws at the beginning of their group, baseInstance gives the
+	// vertex shader the draw record index (gl_DrawID is not available in GLSL 4.30)
+	uint slot = atomicAdd(counters[draw.group], 1u);
+	if (pass != CULL_PASS_VISIBLE)
+		atomicAdd(drawnCount, 1u);
+	commands[groupBase[draw.group] + slot] = DrawCommand(draw.indexCount, 1u, draw.firstIndex, draw.baseVertex, i);
+}
+
+#endif
+#endif
@@ -7,66 +7,158 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 5) in uint aDrawID;
+layout(location = 6) in mat4 aInstanceModel; // 6 to 9
+layout(location = 10) in uint aInstanceMaterial;
 
+// The depth pre-pass (DEPTH_ONLY) and the G-buffer pass must produce the exact same depth for GL_EQUAL
+invariant gl_Position;
+
+#ifndef DEPTH_ONLY
 out vec3 FragPos;
 out vec2 TexCoord;
 out vec3 Normal;
+flat out uint MaterialID;
+#endif
+
+layout(std140, binding = 0) uniform FrameBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+	int lightCount;
+};
+
+// Draws generated by the GPU culling read their transform and material through the draw record,
+// the instanced ones from the instance stream
+layout(std140, binding = 1) uniform DrawBlock
+{
+	bool useObjectBuffer;
+};
+
+// Must match GPUDrawRecord in engine.h
+struct DrawRecord
+{
+	vec4 aabbMin;
+	vec4 aabbMax;
+	uint objectIndex;
+	uint group;
+	uint indexCount;
+	uint firstIndex;
+	int  baseVertex;
+	uint materialIdx;
+	uint pad0;
+	uint pad1;
+};
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout(std430, binding = 0) readonly buffer DrawRecords { DrawRecord draws[]; };
+layout(std430, binding = 1) readonly buffer ObjectTransforms { mat4 objectTransforms[]; };
 
 void main()
 {
-	vec4 worldPos = model * vec4(aPos, 1.0);
+	mat4 modelMatrix;
+	if (useObjectBuffer)
+		modelMatrix = objectTransforms[draws[aDrawID].objectIndex];
+	else
+		modelMatrix = aInstanceModel;
+	vec4 worldPos = modelMatrix * vec4(aPos, 1.0);
+	gl_Position = projection * view * worldPos;
 
+#ifndef DEPTH_ONLY
+	MaterialID = useObjectBuffer ? draws[aDrawID].materialIdx : aInstanceMaterial;
 	FragPos = worldPos.xyz;
 	TexCoord = aTexCoord;
-	mat3 normalMatrix = transpose(inverse(mat3(model)));
+	mat3 normalMatrix = transpose(inverse(mat3(modelMatrix)));
 	Normal = normalMatrix * aNormal;
-	gl_Position = projection * view * worldPos;
+#endif
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
+#ifdef DEPTH_ONLY
+// Only the depth is written, the position stream has no other attribute
+void main()
+{
+}
+#else
+#ifdef COMPACT_GBUFFER
+// Same locations as the classic layout, position and specular have no target
+layout (location = 1) out vec4 gNormal; // octahedral normal, smoothness, alpha
+layout (location = 2) out vec4 gAlbedo; // albedo, specular
+#else
 layout (location = 0) out vec3 gPosition;
 layout (location = 1) out vec3 gNormal;
 layout (location = 2) out vec3 gAlbedo;
 layout (location = 3) out vec3 gSpec;
+#endif
 
 in vec3 FragPos;
 in vec2 TexCoord;
 in vec3 Normal;
+flat in uint MaterialID;
 
-uniform float useTexture;
 uniform sampler2D tdiffuse;
 uniform sampler2D tspecular;
 
-uniform float useColor;
-uniform vec3 albedo;
-uniform vec3 emissive;
-uniform float smoothness;
+// Must match GPUMaterial in engine.h
+struct Material
+{
+	vec3 albedo;
+	float useTexture;
+	vec3 emissive;
+	float useColor;
+	float smoothness;
+};
+
+layout(std430, binding = 6) readonly buffer Materials { Material materials[]; };
+
+// Unit vector to [-1, 1]^2 through the octahedron unfolded on the z = 0 plane
+vec2 octEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if (n.z < 0.0)
+		e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e;
+}
 
 void main()
 {
-	gPosition = FragPos;
-	gNormal = normalize(Normal);
+	Material material = materials[MaterialID];
+	vec3 albedo = material.albedo;
+	float useTexture = material.useTexture;
+	float useColor = material.useColor;
+	float smoothness = material.smoothness;
+
+	vec3 outAlbedo = vec3(0.0);
+	vec3 outSpec = vec3(0.0); // specular, smoothness, alpha
 
 	if (useTexture > 0.0f && useColor > 0.0f)
 	{
-		gAlbedo = texture(tdiffuse, TexCoord).rgb * albedo;
-		gSpec = vec3(texture(tspecular, TexCoord).r, smoothness,0.0);
+		outAlbedo = texture(tdiffuse, TexCoord).rgb * albedo;
+		outSpec = vec3(texture(tspecular, TexCoord).r, smoothness,0.0);
 	}
 	else if (useTexture > 0.0f)
 	{
-		gAlbedo = texture(tdiffuse, TexCoord).rgb;
-		gSpec = vec3(texture(tspecular, TexCoord).r, smoothness,0.0);
+		outAlbedo = texture(tdiffuse, TexCoord).rgb;
+		outSpec = vec3(texture(tspecular, TexCoord).r, smoothness,0.0);
 	}
 	else if (useColor > 0.0f)
 	{
-		gAlbedo = albedo;
-		gSpec = vec3(0.0, smoothness, 0.0);
+		outAlbedo = albedo;
+		outSpec = vec3(0.0, smoothness, 0.0);
 	}
+
+#ifdef COMPACT_GBUFFER
+	gNormal = vec4(octEncode(normalize(Normal)) * 0.5 + 0.5, clamp(outSpec.g, 0.0, 1.0), outSpec.b);
+	gAlbedo = vec4(outAlbedo, outSpec.r);
+#else
+	gPosition = FragPos;
+	gNormal = normalize(Normal);
+	gAlbedo = outAlbedo;
+	gSpec = outSpec;
+#endif
 }
 
+#endif // DEPTH_ONLY
+#endif
 #endif
-#endif
\ No newline at end of file
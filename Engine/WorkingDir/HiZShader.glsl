@@ -0,0 +1,53 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef HIZ_BUILD
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// Level 0 copies the depth buffer, the next levels keep the farthest depth of the previous one
+uniform bool fromDepth;
+uniform sampler2D depth;
+layout(binding = 0, r32f) uniform readonly image2D srcLevel;
+layout(binding = 1, r32f) uniform writeonly image2D dstLevel;
+
+float fetchDepth(ivec2 p, ivec2 srcSize)
+{
+	p = min(p, srcSize - 1);
+	return fromDepth ? texelFetch(depth, p, 0).r : imageLoad(srcLevel, p).r;
+}
+
+void main()
+{
+	ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 dstSize = imageSize(dstLevel);
+	if (dst.x >= dstSize.x || dst.y >= dstSize.y)
+		return;
+
+	if (fromDepth)
+	{
+		imageStore(dstLevel, dst, vec4(texelFetch(depth, dst, 0).r));
+		return;
+	}
+
+	ivec2 srcSize = imageSize(srcLevel);
+	ivec2 src = dst * 2;
+	float d = max(max(fetchDepth(src, srcSize), fetchDepth(src + ivec2(1, 0), srcSize)),
+	              max(fetchDepth(src + ivec2(0, 1), srcSize), fetchDepth(src + ivec2(1, 1), srcSize)));
+
+	// Odd sizes: the last row/column also covers the texels that would be dropped
+	bool extraX = (srcSize.x & 1) != 0 && dst.x == dstSize.x - 1;
+	bool extraY = (srcSize.y & 1) != 0 && dst.y == dstSize.y - 1;
+	if (extraX)
+		d = max(d, max(fetchDepth(src + ivec2(2, 0), srcSize), fetchDepth(src + ivec2(2, 1), srcSize)));
+	if (extraY)
+		d = max(d, max(fetchDepth(src + ivec2(0, 2), srcSize), fetchDepth(src + ivec2(1, 2), srcSize)));
+	if (extraX && extraY)
+		d = max(d, fetchDepth(src + ivec2(2, 2), srcSize));
+
+	imageStore(dstLevel, dst, vec4(d));
+}
+
+#endif
+#endif
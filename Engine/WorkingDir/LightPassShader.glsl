@@ -9,16 +9,30 @@ layout(location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
 
+#ifdef LIGHT_VOLUMES
+uniform mat4 volumeTransform; // Unit sphere or cone to clip space, identity for the fullscreen quad
+#endif
+
 void main()
 {
 	TexCoord = aTexCoord;
+#ifdef LIGHT_VOLUMES
+	gl_Position = volumeTransform * vec4(aPos, 1.0);
+#else
 	gl_Position = vec4(aPos, 1.0);
+#endif
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
-layout (location = 4) out vec4 aRes;
+layout (location = 0) out vec4 aRes;
 
+#ifdef LIGHT_VOLUMES
+// One light per draw, the volumes cover only part of the screen
+uniform int lightIndex;
+uniform vec2 viewportSize;
+#else
 in vec2 TexCoord;
+#endif
 
 struct Light {
     vec4 positionType;
@@ -27,83 +41,174 @@ struct Light {
     vec4 clq; //constant linear quadratic
     vec4 co; //cutoff outercutoff
 };
-const int NR_LIGHTS = 203;
-uniform Light lights[NR_LIGHTS];
-uniform int count;
-uniform vec3 viewPos;
+layout(std430, binding = 0) readonly buffer Lights { Light lights[]; };
 
+layout(std140, binding = 0) uniform FrameBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+	int lightCount;
+	mat4 inverseViewProjection;
+	vec2 renderScale; // The frame covers this part of the G-buffer
+	int firstPointLight; // The lights are sorted by type: directional, point, spot
+	int firstSpotLight;
+};
+
+#ifdef COMPACT_GBUFFER
+uniform sampler2D gNormal; // octahedral normal, smoothness, alpha
+uniform sampler2D gAlbedo; // albedo, specular
+uniform sampler2D gDepth;
+
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+#else
 uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedo;
 uniform sampler2D gSpec;
+#endif
 
-vec3 calculateLight(float type, vec3 viewDir, vec3 objectPosition, vec3 lightPositon, vec3 objectNormal, vec3 objectDiffuse, vec3 lightDiffuse, float shininess, float objectSpecular, float lightSpecular, float intensity, float constant, float linear, float quadratic, vec3 direction, float cutoff, float outercutoff)
+#ifdef CLUSTERED_LIGHTING
+// Must match the CLUSTER_ values in clusters.h
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+// Per cluster (offset, count) into clusterIndices, x fastest, then y, then the depth slice
+layout(std430, binding = 1) readonly buffer Clusters { uvec2 clusters[]; };
+layout(std430, binding = 2) readonly buffer ClusterIndices { uint clusterIndices[]; };
+
+uniform int globalLightCount;     // Directional lights, first in clusterIndices
+uniform vec2 clusterDepthScaleBias; // slice = log(view depth) * x + y
+#endif
+
+// Surface attributes read from the G-buffer
+struct Surface
 {
-			vec3 lightDir = normalize(lightPositon - objectPosition);
-			vec3 specular = vec3(0.0, 0.0, 0.0);
-			vec3 res_light = vec3(0.0, 0.0, 0.0);
-
-			if (type == 0.0) // DIRECTIONAL_LIGHT
-			{
-				vec3 diffuse = lightDiffuse * max(dot(objectNormal, lightDir), 0.0) * objectDiffuse;
-
-				if (dot(objectNormal, lightDir) > 0.0)
-					specular = vec3(pow(max(dot(viewDir, reflect(-lightDir, objectNormal)), 0.0), shininess) * lightSpecular * objectSpecular);
-
-				res_light = diffuse + specular;
-			}
-			else if (type == 1.0) // POINT_LIGHT
-			{
-				vec3 diffuse = lightDiffuse * max(dot(objectNormal, lightDir), 0.0) * objectDiffuse;
-				
-				if (dot(objectNormal, lightDir) > 0.0)
-					specular = vec3(pow(max(dot(viewDir, reflect(-lightDir, objectNormal)), 0.0), shininess) * lightSpecular * objectSpecular);
-				
-				float distance = length(lightPositon - objectPosition);
-				float attenuation = 1.0 / (constant + linear * distance + quadratic * (distance * distance));
-				
-				diffuse *= attenuation;
-				specular *= attenuation;
-				res_light = diffuse + specular;
-			}
-			else if (type == 2.0) // SPOT_LIGHT
-			{
-				float theta = dot(lightDir, normalize(-direction));
-				if(theta > outercutoff)
-				{
-					vec3 diffuse = lightDiffuse * max(dot(objectNormal, lightDir), 0.0) * objectDiffuse;
-					
-					if (dot(objectNormal, lightDir) > 0.0)
-						specular = vec3(pow(max(dot(viewDir, reflect(-lightDir, objectNormal)), 0.0), shininess) * lightSpecular * objectSpecular);
-					
-					float smoothness = clamp((theta - outercutoff) / (cutoff - outercutoff), 0.0, 1.0);
-					
-					float distance = length(lightPositon - objectPosition);
-					float attenuation = 1.0 / (constant + linear * distance + quadratic * (distance * distance));
-					
-					diffuse *= attenuation * smoothness;
-					specular *= attenuation * smoothness;
-					res_light = diffuse + specular;
-				}
-			}
-			return res_light * intensity;
+	vec3 position;
+	vec3 normal;
+	vec3 diffuse;
+	float specular;
+	float shininess;
+	vec3 viewDir;
+};
+
+// Diffuse and specular of light i reaching the surface from lightDir, shared by every light type
+vec3 phong(uint i, vec3 lightDir, Surface s)
+{
+	float NdotL = dot(s.normal, lightDir);
+	vec3 diffuse = lights[i].diffuseSpecular.xyz * max(NdotL, 0.0) * s.diffuse;
+	float specular = NdotL > 0.0 ? pow(max(dot(s.viewDir, reflect(-lightDir, s.normal)), 0.0), s.shininess) * lights[i].diffuseSpecular.w * s.specular : 0.0;
+	return (diffuse + vec3(specular)) * lights[i].directionIntensity.w;
 }
+
+float attenuation(uint i, vec3 position)
+{
+	float distance = length(lights[i].positionType.xyz - position);
+	return 1.0 / (lights[i].clq.x + lights[i].clq.y * distance + lights[i].clq.z * (distance * distance));
+}
+
+vec3 directionalLight(uint i, Surface s)
+{
+	// Uploaded at the origin, the light comes from there
+	return phong(i, normalize(lights[i].positionType.xyz - s.position), s);
+}
+
+vec3 pointLight(uint i, Surface s)
+{
+	return phong(i, normalize(lights[i].positionType.xyz - s.position), s) * attenuation(i, s.position);
+}
+
+vec3 spotLight(uint i, Surface s)
+{
+	// The smoothness is already 0 outside the outer cone. Equal cutoffs would divide 0 by 0 at the edge.
+	vec3 lightDir = normalize(lights[i].positionType.xyz - s.position);
+	float theta = dot(lightDir, normalize(-lights[i].directionIntensity.xyz));
+	float smoothness = clamp((theta - lights[i].co.y) / max(lights[i].co.x - lights[i].co.y, 1e-4), 0.0, 1.0);
+	return phong(i, lightDir, s) * attenuation(i, s.position) * smoothness;
+}
+
+// Light of any type, for the lists that mix them. Types as in LightType (engine.h).
+vec3 shadeLight(uint i, Surface s)
+{
+	int type = int(lights[i].positionType.w);
+	if (type == 0)
+		return directionalLight(i, s);
+	if (type == 1)
+		return pointLight(i, s);
+	return spotLight(i, s);
+}
+
 void main()
 {
-	vec3 Position = texture(gPosition, TexCoord).rgb;
-	vec3 Normal = normalize(texture(gNormal, TexCoord).rgb);
-	vec3 Diffuse = texture(gAlbedo, TexCoord).rgb;
-	float Specular = texture(gSpec, TexCoord).r;
-	float shininess = texture(gSpec, TexCoord).g;
-	float opacity = texture(gSpec, TexCoord).b;
-
-    vec3 lighting = vec3(0.0, 0.0, 0.0);
-	vec3 viewDir = normalize(viewPos - Position);
-
-	for (int i = 0; i < count; ++i)
-   {
-		lighting += calculateLight(lights[i].positionType.w, viewDir, Position, lights[i].positionType.xyz, Normal, Diffuse, lights[i].diffuseSpecular.xyz, shininess, Specular, lights[i].diffuseSpecular.w, lights[i].directionIntensity.w, lights[i].clq.x, lights[i].clq.y, lights[i].clq.z, lights[i].directionIntensity.xyz, lights[i].co.x, lights[i].co.y);
-   }
+#ifdef LIGHT_VOLUMES
+	vec2 TexCoord = gl_FragCoord.xy / viewportSize;
+#endif
+	// TexCoord spans the viewport, uv the part of the G-buffer it was rendered to
+	vec2 uv = TexCoord * renderScale;
+
+#ifdef COMPACT_GBUFFER
+	// World position from the depth buffer and the inverse view projection
+	float depth = texture(gDepth, uv).r;
+	vec4 worldPos = inverseViewProjection * vec4(vec3(TexCoord, depth) * 2.0 - 1.0, 1.0);
+	vec3 Position = worldPos.xyz / worldPos.w;
+
+	vec4 normalSmoothness = texture(gNormal, uv);
+	vec4 albedoSpecular = texture(gAlbedo, uv);
+	vec3 Normal = octDecode(normalSmoothness.xy * 2.0 - 1.0);
+	vec3 Diffuse = albedoSpecular.rgb;
+	float Specular = albedoSpecular.a;
+	float shininess = normalSmoothness.z;
+	float opacity = normalSmoothness.w;
+#else
+	vec3 Position = texture(gPosition, uv).rgb;
+	vec3 Normal = normalize(texture(gNormal, uv).rgb);
+	vec3 Diffuse = texture(gAlbedo, uv).rgb;
+	float Specular = texture(gSpec, uv).r;
+	float shininess = texture(gSpec, uv).g;
+	float opacity = texture(gSpec, uv).b;
+#endif
+
+	Surface surface = Surface(Position, Normal, Diffuse, Specular, shininess, normalize(viewPos - Position));
+	vec3 lighting = vec3(0.0, 0.0, 0.0);
+
+#if defined(LIGHT_VOLUMES)
+	lighting = shadeLight(uint(lightIndex), surface);
+#elif defined(CLUSTERED_LIGHTING)
+	// Only the lights of the froxel, after the directional ones touching every pixel
+	float viewDepth = max(-(view * vec4(Position, 1.0)).z, 1e-4);
+	uint slice = uint(clamp(log(viewDepth) * clusterDepthScaleBias.x + clusterDepthScaleBias.y, 0.0, float(CLUSTER_Z - 1)));
+	uvec2 tile = min(uvec2(TexCoord * vec2(CLUSTER_X, CLUSTER_Y)), uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+	uvec2 cluster = clusters[(slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x];
+
+	for (uint i = 0u; i < uint(globalLightCount); ++i)
+		lighting += directionalLight(clusterIndices[i], surface);
+
+	// The cluster lists keep the light order, the point lights come before the spots
+	uint k = 0u;
+	for (; k < cluster.y && clusterIndices[cluster.x + k] < uint(firstSpotLight); ++k)
+		lighting += pointLight(clusterIndices[cluster.x + k], surface);
+	for (; k < cluster.y; ++k)
+		lighting += spotLight(clusterIndices[cluster.x + k], surface);
+#elif defined(MIXED_LIGHT_LOOP)
+	// Reference for the per type loops below, the type is checked per light
+	for (int i = 0; i < lightCount; ++i)
+		lighting += shadeLight(uint(i), surface);
+#else
+	// The lights are bucketed by type (UploadLights), each range has its own loop
+	for (int i = 0; i < firstPointLight; ++i)
+		lighting += directionalLight(uint(i), surface);
+	for (int i = firstPointLight; i < firstSpotLight; ++i)
+		lighting += pointLight(uint(i), surface);
+	for (int i = firstSpotLight; i < lightCount; ++i)
+		lighting += spotLight(uint(i), surface);
+#endif
 	aRes = vec4(lighting,opacity);
 }
 
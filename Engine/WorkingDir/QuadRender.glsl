@@ -23,10 +23,11 @@ out vec4 FragColor;
 in vec2 vTexCoord;
 
 uniform sampler2D uTexture;
+uniform vec2 uvScale; // Part of the texture the frame was rendered to, stretched to the screen
 
 void main()
 {
-    FragColor = texture(uTexture, vTexCoord);
+    FragColor = texture(uTexture, vTexCoord * uvScale);
 } 
 
 #endif
@@ -0,0 +1,239 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef TILED_LIGHTING
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+// One work group per 16x16 pixel tile. The group finds the depth bounds of its pixels, culls the
+// light buffer against the tile frustum into shared memory, then each pixel shades those lights only.
+#define TILE_SIZE 16
+#define MAX_TILE_LIGHTS 256 // Per light type, lights past it are dropped from the tile
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+// Must match GPULight in engine.h
+struct Light {
+    vec4 positionType;
+    vec4 directionIntensity;
+    vec4 diffuseSpecular;
+    vec4 clq; //constant linear quadratic range
+    vec4 co; //cutoff outercutoff
+};
+layout(std430, binding = 0) readonly buffer Lights { Light lights[]; };
+
+layout(std140, binding = 0) uniform FrameBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+	int lightCount;
+	mat4 inverseViewProjection;
+	vec2 renderScale;
+	int firstPointLight; // The lights are sorted by type: directional, point, spot
+	int firstSpotLight;
+};
+
+uniform mat4 inverseProjection;
+uniform ivec2 viewportSize; // Pixels of the G-buffer the frame covers, from the origin
+
+uniform sampler2D gDepth;
+#ifdef COMPACT_GBUFFER
+uniform sampler2D gNormal; // octahedral normal, smoothness, alpha
+uniform sampler2D gAlbedo; // albedo, specular
+
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+#else
+uniform sampler2D gPosition;
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpec;
+#endif
+
+layout(binding = 0, rgba16f) uniform writeonly image2D result;
+
+shared uint tileMinDepth;
+shared uint tileMaxDepth;
+shared uint tilePointCount;
+shared uint tileSpotCount;
+shared uint tilePointLights[MAX_TILE_LIGHTS];
+shared uint tileSpotLights[MAX_TILE_LIGHTS];
+shared vec3 tilePlanes[4];
+
+// Surface attributes read from the G-buffer. Must match the light functions in LightPassShader.glsl
+struct Surface
+{
+	vec3 position;
+	vec3 normal;
+	vec3 diffuse;
+	float specular;
+	float shininess;
+	vec3 viewDir;
+};
+
+// Diffuse and specular of light i reaching the surface from lightDir, shared by every light type
+vec3 phong(uint i, vec3 lightDir, Surface s)
+{
+	float NdotL = dot(s.normal, lightDir);
+	vec3 diffuse = lights[i].diffuseSpecular.xyz * max(NdotL, 0.0) * s.diffuse;
+	float specular = NdotL > 0.0 ? pow(max(dot(s.viewDir, reflect(-lightDir, s.normal)), 0.0), s.shininess) * lights[i].diffuseSpecular.w * s.specular : 0.0;
+	return (diffuse + vec3(specular)) * lights[i].directionIntensity.w;
+}
+
+float attenuation(uint i, vec3 position)
+{
+	float distance = length(lights[i].positionType.xyz - position);
+	return 1.0 / (lights[i].clq.x + lights[i].clq.y * distance + lights[i].clq.z * (distance * distance));
+}
+
+vec3 directionalLight(uint i, Surface s)
+{
+	// Uploaded at the origin, the light comes from there
+	return phong(i, normalize(lights[i].positionType.xyz - s.position), s);
+}
+
+vec3 pointLight(uint i, Surface s)
+{
+	return phong(i, normalize(lights[i].positionType.xyz - s.position), s) * attenuation(i, s.position);
+}
+
+vec3 spotLight(uint i, Surface s)
+{
+	// The smoothness is already 0 outside the outer cone. Equal cutoffs would divide 0 by 0 at the edge.
+	vec3 lightDir = normalize(lights[i].positionType.xyz - s.position);
+	float theta = dot(lightDir, normalize(-lights[i].directionIntensity.xyz));
+	float smoothness = clamp((theta - lights[i].co.y) / max(lights[i].co.x - lights[i].co.y, 1e-4), 0.0, 1.0);
+	return phong(i, lightDir, s) * attenuation(i, s.position) * smoothness;
+}
+
+// View space point on the far plane
+vec3 viewCorner(vec2 ndc)
+{
+	vec4 p = inverseProjection * vec4(ndc, 1.0, 1.0);
+	return p.xyz / p.w;
+}
+
+// Distance in front of the eye of a depth buffer value
+float viewDistance(float depth)
+{
+	vec4 p = inverseProjection * vec4(0.0, 0.0, depth * 2.0 - 1.0, 1.0);
+	return -p.z / p.w;
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	bool inside = pixel.x < viewportSize.x && pixel.y < viewportSize.y;
+	uint local = gl_LocalInvocationIndex;
+
+	if (local == 0u)
+	{
+		tileMinDepth = 0xFFFFFFFFu;
+		tileMaxDepth = 0u;
+		tilePointCount = 0u;
+		tileSpotCount = 0u;
+
+		// Side planes through the eye and the tile edges, normals pointing inside
+		vec2 ndcMin = vec2(gl_WorkGroupID.xy) * float(TILE_SIZE) / vec2(viewportSize) * 2.0 - 1.0;
+		vec2 ndcMax = min((vec2(gl_WorkGroupID.xy) + 1.0) * float(TILE_SIZE) / vec2(viewportSize), vec2(1.0)) * 2.0 - 1.0;
+		vec3 corners[4] = vec3[](viewCorner(ndcMin), viewCorner(vec2(ndcMax.x, ndcMin.y)), viewCorner(ndcMax), viewCorner(vec2(ndcMin.x, ndcMax.y)));
+		vec3 center = viewCorner(0.5 * (ndcMin + ndcMax));
+		for (int i = 0; i < 4; ++i)
+		{
+			vec3 n = normalize(cross(corners[i], corners[(i + 1) % 4]));
+			tilePlanes[i] = dot(n, center) < 0.0 ? -n : n;
+		}
+	}
+	barrier();
+
+	// Depths in [0, 1] compare as their bits, the background doesn't widen the bounds
+	float depth = inside ? texelFetch(gDepth, pixel, 0).r : 1.0;
+	if (depth < 1.0)
+	{
+		atomicMin(tileMinDepth, floatBitsToUint(depth));
+		atomicMax(tileMaxDepth, floatBitsToUint(depth));
+	}
+	barrier();
+
+	if (tileMinDepth <= tileMaxDepth)
+	{
+		float nearDistance = viewDistance(uintBitsToFloat(tileMinDepth));
+		float farDistance = viewDistance(uintBitsToFloat(tileMaxDepth));
+		// Directional lights touch every tile, they are not listed. The others within their range sphere.
+		for (uint i = uint(firstPointLight) + local; i < uint(lightCount); i += uint(TILE_SIZE * TILE_SIZE))
+		{
+			vec3 center = (view * vec4(lights[i].positionType.xyz, 1.0)).xyz;
+			float radius = lights[i].clq.w;
+			bool touches = -center.z + radius >= nearDistance && -center.z - radius <= farDistance;
+			for (int p = 0; p < 4 && touches; ++p)
+				touches = dot(tilePlanes[p], center) >= -radius;
+
+			// One list per type, so each is shaded by its own loop
+			if (touches && i < uint(firstSpotLight))
+			{
+				uint slot = atomicAdd(tilePointCount, 1u);
+				if (slot < MAX_TILE_LIGHTS)
+					tilePointLights[slot] = i;
+			}
+			else if (touches)
+			{
+				uint slot = atomicAdd(tileSpotCount, 1u);
+				if (slot < MAX_TILE_LIGHTS)
+					tileSpotLights[slot] = i;
+			}
+		}
+	}
+	barrier();
+
+	if (!inside)
+		return;
+	if (depth >= 1.0)
+	{
+		imageStore(result, pixel, vec4(0.0));
+		return;
+	}
+
+#ifdef COMPACT_GBUFFER
+	// World position from the depth buffer and the inverse view projection
+	vec2 ndc = (vec2(pixel) + 0.5) / vec2(viewportSize) * 2.0 - 1.0;
+	vec4 worldPos = inverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+	vec3 Position = worldPos.xyz / worldPos.w;
+
+	vec4 normalSmoothness = texelFetch(gNormal, pixel, 0);
+	vec4 albedoSpecular = texelFetch(gAlbedo, pixel, 0);
+	vec3 Normal = octDecode(normalSmoothness.xy * 2.0 - 1.0);
+	vec3 Diffuse = albedoSpecular.rgb;
+	float Specular = albedoSpecular.a;
+	float shininess = normalSmoothness.z;
+	float opacity = normalSmoothness.w;
+#else
+	vec3 Position = texelFetch(gPosition, pixel, 0).rgb;
+	vec3 Normal = normalize(texelFetch(gNormal, pixel, 0).rgb);
+	vec3 Diffuse = texelFetch(gAlbedo, pixel, 0).rgb;
+	vec3 spec = texelFetch(gSpec, pixel, 0).rgb;
+	float Specular = spec.r;
+	float shininess = spec.g;
+	float opacity = spec.b;
+#endif
+
+	Surface surface = Surface(Position, Normal, Diffuse, Specular, shininess, normalize(viewPos - Position));
+	vec3 lighting = vec3(0.0, 0.0, 0.0);
+
+	for (int i = 0; i < firstPointLight; ++i)
+		lighting += directionalLight(uint(i), surface);
+	uint pointCount = min(tilePointCount, uint(MAX_TILE_LIGHTS));
+	for (uint t = 0u; t < pointCount; ++t)
+		lighting += pointLight(tilePointLights[t], surface);
+	uint spotCount = min(tileSpotCount, uint(MAX_TILE_LIGHTS));
+	for (uint t = 0u; t < spotCount; ++t)
+		lighting += spotLight(tileSpotLights[t], surface);
+	imageStore(result, pixel, vec4(lighting, opacity));
+}
+
+#endif
+#endif